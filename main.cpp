@@ -1,11 +1,307 @@
+#include "cells.hpp"
+#include "graph.hpp"
+#include "network.hpp"
+#include "raytrace.hpp"
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <torch/torch.h>
+#include <vector>
 
-int add(int a, int b) { return a + b; }
+using namespace torch;
 
-int main() {
-    int result = add(3, 4);
-    std::cout << "Result is: " << result << std::endl;
+// Parallel sweep driver: builds every combination of the listed modeldata values and saves each network.
+//
+//   raybnn_sweep sweep.cfg
+//
+// The config holds one "key = value[, value...]" per line, '#' starts a comment. Keys are modeldata fields
+// plus the driver settings below; every key with several values is one axis of the cartesian product.
+//   jobs        builds running concurrently, 0 picks min(builds, hardware threads)
+//   output_dir  where build_<k>.pt and report.csv are written
+//   loop_depth  depth of delete_loops, defaults to proc_num
+//
+// Builds run on one pool of `jobs` threads that take the next build from a shared counter. ATen's intra-op
+// thread count is a single process-wide setting: it is set once to hardware_threads / jobs before the pool
+// starts, so the node stays busy without oversubscription whatever the mix of serial and parallel stages.
 
-    return 0;
+constexpr float PLACEMENT_OVERSAMPLE = 1.2f; // extra cells placed to make up for collision removal
+
+const std::vector<std::string> STAGES = {"placement", "collision", "split", "raytrace", "delete_loops", "save"};
+
+struct sweep_config {
+    std::map<std::string, std::vector<std::string>> values; // modeldata keys, one sweep axis each
+    int64_t jobs = 0;
+    std::string output_dir = "sweep_out";
+    int64_t loop_depth = -1;
+};
+
+struct build_result {
+    std::map<std::string, std::string> swept;
+    std::map<std::string, double> stage_s;
+    int64_t neurons = 0;
+    int64_t edges = 0;
+    // CPU weight matrix of the built network, see block_sparse
+    int64_t block_size = 0;
+    double block_fill = 0.0;     // edges per dense block element
+    double block_coverage = 0.0; // share of the edges stored in dense blocks
+    std::string file;
+    std::string error;
+};
+
+static std::string trim(const std::string &s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    size_t end = s.find_last_not_of(" \t\r");
+    return begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+}
+
+static sweep_config read_config(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot open " + path);
+    sweep_config config;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error("expected key = value: " + line);
+        std::string key = trim(line.substr(0, eq));
+        std::vector<std::string> vals;
+        std::stringstream list(line.substr(eq + 1));
+        std::string v;
+        while (std::getline(list, v, ','))
+            vals.push_back(trim(v));
+        if (key == "jobs")
+            config.jobs = std::stoll(vals.at(0));
+        else if (key == "output_dir")
+            config.output_dir = vals.at(0);
+        else if (key == "loop_depth")
+            config.loop_depth = std::stoll(vals.at(0));
+        else
+            config.values[key] = vals;
+    }
+    return config;
+}
+
+// cartesian product of all value lists, each entry maps every key to one value
+static std::vector<std::map<std::string, std::string>> expand(const sweep_config &config) {
+    std::vector<std::map<std::string, std::string>> variants = {{}};
+    for (const auto &[key, vals] : config.values) {
+        std::vector<std::map<std::string, std::string>> next;
+        for (const auto &variant : variants) {
+            for (const std::string &v : vals) {
+                auto extended = variant;
+                extended[key] = v;
+                next.push_back(std::move(extended));
+            }
+        }
+        variants = std::move(next);
+    }
+    return variants;
+}
+
+// Neurons are numbered inputs first, then the interior neurons; the last output_size of those are the outputs
+// ws is owned by the calling pool thread, so its raytrace buffers carry over from one build to the next
+static void build_network(const modeldata &base, int64_t loop_depth, const std::string &file, raytrace_workspace &ws, build_result &result) {
+    using clock = std::chrono::steady_clock;
+    auto stage_start = clock::now();
+    auto stage_done = [&](const std::string &stage) {
+        auto now = clock::now();
+        result.stage_s[stage] = std::chrono::duration<double>(now - stage_start).count();
+        stage_start = now;
+    };
+
+    modeldata model_info = base;
+    cells c;
+    int64_t interior_target = model_info.neuron_size - model_info.input_size;
+    if (interior_target <= model_info.output_size || model_info.nration <= 0.0f || model_info.nration > 1.0f)
+        throw std::runtime_error("need neuron_size > input_size + output_size and 0 < nration <= 1");
+
+    int64_t num_cells = static_cast<int64_t>(std::ceil(interior_target / model_info.nration * PLACEMENT_OVERSAMPLE));
+    Tensor input_pos = c.sphere_even(model_info.input_size, model_info.sphere_rad);
+    Tensor cell_pos = c.ball_random(num_cells, model_info.sphere_rad);
+    stage_done("placement");
+
+    cell_pos = c.check_all_collision_minibatch(cell_pos, model_info.sphere_rad, model_info.neuron_rad);
+    stage_done("collision");
+
+    auto [neuron_pos, glia_pos] = c.split_into_glia_neuron(model_info.nration, cell_pos);
+    int64_t interior = std::min(interior_target, neuron_pos.size(0));
+    if (interior <= model_info.output_size)
+        throw std::runtime_error("too few neurons left after collision removal");
+    neuron_pos = neuron_pos.slice(0, 0, interior);
+    model_info.neuron_size = model_info.input_size + interior;
+    stage_done("split");
+
+    // input -> interior and interior -> interior in one sweep, then mapped to global neuron indices
+    raytrace tracer;
+    auto fused = tracer.raytrace_fused(ws, model_info, glia_pos, {input_pos, neuron_pos}, {{0, 1}, {1, 1}});
+    auto [in_row, in_col] = fused[0];
+    auto [hid_row, hid_col] = fused[1];
+    Tensor WRowIdx = torch::cat({in_row, hid_row}, 0) + model_info.input_size;
+    Tensor WColIdx = torch::cat({in_col, hid_col + model_info.input_size}, 0);
+    raytrace::dedup_and_sort(WRowIdx, WColIdx);
+    stage_done("raytrace");
+
+    if (WRowIdx.size(0) > 0 && loop_depth > 0) {
+        Tensor input_idx = torch::arange(model_info.input_size, torch::dtype(torch::kLong));
+        Tensor output_idx = torch::arange(model_info.neuron_size - model_info.output_size, model_info.neuron_size, torch::dtype(torch::kLong));
+        Tensor WValues = torch::zeros({WRowIdx.size(0)});
+        RayBNNGraph graph(WRowIdx, WColIdx);
+        graph.delete_loops(output_idx, input_idx, model_info.neuron_size, loop_depth, WValues, WRowIdx, WColIdx);
+        // delete_loops outputs [E,1]
+        WRowIdx = WRowIdx.view({-1});
+        WColIdx = WColIdx.view({-1});
+    }
+    stage_done("delete_loops");
+
+    network net(model_info, WRowIdx, WColIdx);
+    net.save(file);
+    result.neurons = model_info.neuron_size;
+    result.edges = WRowIdx.size(0);
+    const block_sparse &blocks = net.blocks();
+    if (blocks.defined()) {
+        result.block_size = blocks.block_size();
+        result.block_fill = blocks.block_fill();
+        result.block_coverage = result.edges > 0 ? static_cast<double>(blocks.num_block_edges()) / result.edges : 0.0;
+    }
+    result.file = file;
+    stage_done("save");
+}
+
+static void write_report(const std::string &path, const std::vector<build_result> &results, const sweep_config &config) {
+    std::ofstream out(path);
+    out << "build";
+    for (const auto &[key, _] : config.values)
+        out << "," << key;
+    out << ",neurons,edges,block_size,block_fill,block_coverage";
+    for (const std::string &stage : STAGES)
+        out << "," << stage << "_s";
+    out << ",file,error\n";
+    for (size_t k = 0; k < results.size(); ++k) {
+        const build_result &r = results[k];
+        out << k;
+        for (const auto &[key, _] : config.values)
+            out << "," << r.swept.at(key);
+        out << "," << r.neurons << "," << r.edges << "," << r.block_size << "," << r.block_fill << "," << r.block_coverage;
+        for (const std::string &stage : STAGES)
+            out << "," << (r.stage_s.count(stage) ? r.stage_s.at(stage) : 0.0);
+        out << "," << r.file << ",\"" << r.error << "\"\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "usage: raybnn_sweep sweep.cfg" << std::endl;
+        return 1;
+    }
+    sweep_config config;
+    std::vector<std::map<std::string, std::string>> variants;
+    std::vector<modeldata> models;
+    try {
+        config = read_config(argv[1]);
+        variants = expand(config);
+        for (const auto &variant : variants) {
+            modeldata model_info{};
+            model_info.ray_neuron_intersect = true;
+            model_info.ray_glia_intersect = true;
+            for (const auto &[key, value] : variant) {
+                if (!set_modeldata_field(model_info, key, value))
+                    throw std::runtime_error("unknown key " + key);
+            }
+            models.push_back(model_info);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "raybnn_sweep: " << e.what() << std::endl;
+        return 1;
+    }
+
+    int64_t hw = std::max<int64_t>(1, std::thread::hardware_concurrency());
+    int64_t num_builds = static_cast<int64_t>(variants.size());
+    int64_t jobs = config.jobs > 0 ? config.jobs : std::min(num_builds, hw);
+    jobs = std::max<int64_t>(1, std::min(jobs, num_builds));
+    int intra_threads = static_cast<int>(std::max<int64_t>(1, hw / jobs));
+    std::filesystem::create_directories(config.output_dir);
+    std::cout << "raybnn_sweep: " << num_builds << " builds, " << jobs << " concurrent, " << intra_threads << " intra-op threads each"
+              << std::endl;
+
+    std::vector<build_result> results(num_builds);
+    std::atomic<int64_t> next{0};
+    std::mutex log_mutex;
+    auto wall_start = std::chrono::steady_clock::now();
+    auto worker = [&]() {
+        // picks up the process-wide count set below; under OpenMP the team size is per calling thread
+        at::init_num_threads();
+        raytrace_workspace ws;
+        for (int64_t k = next++; k < num_builds; k = next++) {
+            build_result &result = results[k];
+            result.swept = variants[k];
+            int64_t depth = config.loop_depth >= 0 ? config.loop_depth : models[k].proc_num;
+            std::string file = (std::filesystem::path(config.output_dir) / ("build_" + std::to_string(k) + ".pt")).string();
+            try {
+                build_network(models[k], depth, file, ws, result);
+            } catch (const std::exception &e) {
+                result.error = e.what();
+            }
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cout << "raybnn_sweep: build " << k << (result.error.empty() ? " done, " + std::to_string(result.edges) + " edges" : " failed: " + result.error)
+                      << std::endl;
+        }
+    };
+    // the intra-op thread count is one process-wide ATen setting, so it is set once before the pool starts
+    // and every build shares it; pool threads never change it
+    at::set_num_threads(intra_threads);
+    std::vector<std::thread> pool;
+    for (int64_t j = 0; j < jobs; ++j)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    std::string report_path = (std::filesystem::path(config.output_dir) / "report.csv").string();
+    write_report(report_path, results, config);
+
+    // per-stage summary over the successful builds
+    std::map<std::string, double> stage_total;
+    int64_t ok = 0;
+    double build_total = 0.0;
+    double fill_total = 0.0;
+    double coverage_total = 0.0;
+    for (const build_result &r : results) {
+        if (!r.error.empty())
+            continue;
+        ok += 1;
+        fill_total += r.block_fill;
+        coverage_total += r.block_coverage;
+        for (const auto &[stage, s] : r.stage_s) {
+            stage_total[stage] += s;
+            build_total += s;
+        }
+    }
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "raybnn_sweep: " << ok << "/" << num_builds << " builds in " << wall_s << " s, report " << report_path << std::endl;
+    for (const std::string &stage : STAGES) {
+        double total = stage_total[stage];
+        std::cout << "  " << std::setw(13) << std::left << stage << std::right << " total " << std::setw(10) << total << " s  mean "
+                  << std::setw(9) << (ok > 0 ? total / ok : 0.0) << " s  share " << std::setw(6)
+                  << (build_total > 0.0 ? 100.0 * total / build_total : 0.0) << " %" << std::endl;
+    }
+    std::cout << "  block fill mean " << (ok > 0 ? fill_total / ok : 0.0) << ", edges in dense blocks mean "
+              << (ok > 0 ? 100.0 * coverage_total / ok : 0.0) << " %" << std::endl;
+    // average number of builds in flight, jobs is the ceiling
+    std::cout << "  builds in flight " << (wall_s > 0.0 ? build_total / wall_s : 0.0) << " of " << jobs << std::endl;
+    return ok == num_builds ? 0 : 1;
 }
@@ -0,0 +1,77 @@
+import os
+import sys
+
+import numpy as np
+import torch
+
+# 从构建目录导入扩展模块, 例如 RAYBNN_PYTHON_PATH=../build/src/python pytest test_bindings.py
+sys.path.insert(0, os.environ.get("RAYBNN_PYTHON_PATH", os.path.join(os.path.dirname(__file__), "../build/src/python")))
+import raybnn
+
+
+def numpy_address(t):
+    return t.numpy().__array_interface__["data"][0]
+
+
+def build_edges():
+    c = raybnn.cells()
+    hidden_pos = c.ball_random(500, 5.0)
+    glia_pos = c.ball_random(100, 5.0)
+
+    model_info = raybnn.modeldata()
+    model_info.neuron_rad = 0.1
+    model_info.con_rad = 1.5
+    model_info.ray_neuron_intersect = True
+    model_info.ray_coverage_schedule = True
+
+    tracer = raybnn.raytrace()
+    WRowIdx, WColIdx = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos)
+    return hidden_pos, WRowIdx, WColIdx
+
+
+def test_raytrace_returns_sorted_unique_edges():
+    hidden_pos, WRowIdx, WColIdx = build_edges()
+    assert WRowIdx.shape[0] > 0
+    key = WRowIdx * hidden_pos.shape[0] + WColIdx
+    assert torch.equal(key, torch.unique(key))
+
+
+def test_returned_tensors_are_numpy_views():
+    # C++ 返回的张量与 numpy 共享同一块内存
+    pos = raybnn.cells().ball_random(50, 2.0)
+    assert numpy_address(pos) == pos.data_ptr()
+    pos.numpy()[0, 0] = 123.0
+    assert pos[0, 0].item() == 123.0
+
+
+def test_graph_shares_edge_storage():
+    _, WRowIdx, WColIdx = build_edges()
+    graph = raybnn.RayBNNGraph(WRowIdx, WColIdx)
+    assert graph.WRowIdx.data_ptr() == WRowIdx.data_ptr()
+    assert graph.WColIdx.data_ptr() == WColIdx.data_ptr()
+    assert numpy_address(graph.WRowIdx) == numpy_address(WRowIdx)
+
+
+def test_batch_pipeline_batches_are_numpy_views():
+    features = torch.arange(20, dtype=torch.float32).view(10, 2)
+    labels = torch.arange(10)
+    seen = 0
+    for x, y in raybnn.batch_pipeline(features, labels, 4):
+        assert torch.equal(x[:, 0], (y * 2).float())
+        assert numpy_address(x) == x.data_ptr()
+        seen += y.shape[0]
+    assert seen == 10
+
+
+def test_reorder_without_weights_returns_none():
+    hidden_pos, WRowIdx, WColIdx = build_edges()
+    graph = raybnn.RayBNNGraph(WRowIdx, WColIdx)
+    perm, pos, values = graph.reorder(hidden_pos.shape[0], hidden_pos)
+    assert values is None
+    assert torch.equal(pos, hidden_pos.index_select(0, perm))
+
+    graph = raybnn.RayBNNGraph(WRowIdx, WColIdx)
+    weights = torch.arange(WRowIdx.shape[0], dtype=torch.float32)
+    perm, _, values = graph.reorder(hidden_pos.shape[0], hidden_pos, weights)
+    assert values.shape == weights.shape
+    assert np.array_equal(np.sort(values.numpy()), weights.numpy())
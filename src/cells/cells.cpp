@@ -1,4 +1,5 @@
 #include "cells.hpp"
+#include "memory_tracker.hpp"
 #include <c10/core/ScalarType.h>
 #include <cassert>
 #include <cmath>
@@ -119,6 +120,7 @@ void set_diag(torch::Tensor &tensor, float value) {
 Tensor cells::check_all_collision_minibatch(const Tensor &cell_pos, const float sphere_rad, const float neuron_rad) const {
     assert(sphere_rad > 0 && neuron_rad > 0);
     assert(cell_pos.dim() == 2 && cell_pos.size(1) == 3);
+    memory_scope scope("collision");
 
     float step = (4.0f / 3.0f) * M_PI * sphere_rad * sphere_rad * sphere_rad * TARGET_DENSITY / cell_pos.size(0);
     std::cout << "step: " << step << std::endl;
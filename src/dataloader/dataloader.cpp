@@ -1,4 +1,6 @@
 #include "dataloader.hpp"
+#include <algorithm>
+#include <cassert>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -25,4 +27,106 @@ torch::Tensor load_csv_to_tensor(const std::string &file_path, const char &delim
     std::vector<float> data = load_csv_to_vector(file_path, delimiter);
     auto tensor = torch::from_blob(data.data(), {static_cast<long>(data.size())}, ops);
     return tensor.clone(); // Clone to ensure the tensor is not referencing the original data
-}
\ No newline at end of file
+}
+
+constexpr int64_t PRODUCER_FAILED = -1;
+constexpr int64_t STOP_PRODUCER = -2;
+
+// features [N,...] and labels [N,...] on CPU, batches are gathered along dim 0
+batch_pipeline::batch_pipeline(const torch::Tensor &features,
+                               const torch::Tensor &labels,
+                               int64_t batch_size,
+                               int64_t prefetch,
+                               int64_t num_epochs,
+                               bool shuffle,
+                               uint64_t seed,
+                               bool pin_memory)
+    : features_(features.contiguous()), labels_(labels.contiguous()), num_samples_(features.size(0)), batch_size_(batch_size),
+      num_epochs_(num_epochs), shuffle_(shuffle), gen_(seed), ready_(2 * prefetch + 4), free_(prefetch + 2) {
+    assert(features.size(0) == labels.size(0));
+    assert(batch_size > 0 && prefetch > 0);
+
+    perm_ = torch::arange(num_samples_, torch::TensorOptions().dtype(torch::kLong));
+
+    // prefetch slots filled ahead plus the one held by the consumer
+    // ready_ holds each slot at most once plus the failure marker, free_ adds a stop marker
+    int64_t num_slots = prefetch + 1;
+    auto make_slot = [&](const torch::Tensor &src) {
+        std::vector<int64_t> shape = src.sizes().vec();
+        shape[0] = batch_size;
+        torch::Tensor buf = torch::empty(shape, src.options());
+        return pin_memory ? buf.pin_memory() : buf;
+    };
+    for (int64_t s = 0; s < num_slots; ++s) {
+        slot_features_.push_back(make_slot(features_));
+        slot_labels_.push_back(make_slot(labels_));
+        slot_len_.push_back(0);
+        free_.push(s);
+    }
+    worker_ = std::thread(&batch_pipeline::produce, this);
+}
+
+batch_pipeline::~batch_pipeline() {
+    stop_.store(true);
+    free_.push(STOP_PRODUCER); // wakes the producer if it waits for a slot
+    worker_.join();
+}
+
+void batch_pipeline::produce() {
+    try {
+        for (int64_t epoch = 0; epoch < num_epochs_; ++epoch) {
+            int64_t *perm = perm_.data_ptr<int64_t>();
+            if (shuffle_)
+                std::shuffle(perm, perm + num_samples_, gen_);
+
+            for (int64_t start = 0; start < num_samples_; start += batch_size_) {
+                int64_t slot = free_.pop(); // backpressure: blocks while prefetch batches are waiting
+                if (slot == STOP_PRODUCER || stop_.load())
+                    return;
+                int64_t len = std::min(batch_size_, num_samples_ - start);
+                torch::Tensor idx = perm_.slice(0, start, start + len);
+                torch::Tensor out_features = slot_features_[slot].narrow(0, 0, len);
+                torch::Tensor out_labels = slot_labels_[slot].narrow(0, 0, len);
+                torch::index_select_out(out_features, features_, 0, idx);
+                torch::index_select_out(out_labels, labels_, 0, idx);
+                slot_len_[slot] = len;
+                ready_.push(slot);
+            }
+            // the end of an epoch is an empty slot, so it waits for a free slot like a batch
+            int64_t slot = free_.pop();
+            if (slot == STOP_PRODUCER || stop_.load())
+                return;
+            slot_len_[slot] = 0;
+            ready_.push(slot);
+        }
+    } catch (...) {
+        // published by the release store of the push, next reads error_ only after popping the marker
+        error_ = std::current_exception();
+        ready_.push(PRODUCER_FAILED);
+    }
+}
+
+bool batch_pipeline::next(torch::Tensor &features, torch::Tensor &labels) {
+    if (held_slot_ >= 0) {
+        free_.push(held_slot_);
+        held_slot_ = -1;
+    }
+    if (failed_)
+        std::rethrow_exception(error_);
+    if (epochs_done_ >= num_epochs_)
+        return false;
+
+    int64_t slot = ready_.pop();
+    if (slot == PRODUCER_FAILED) {
+        failed_ = true;
+        std::rethrow_exception(error_);
+    }
+    held_slot_ = slot;
+    if (slot_len_[slot] == 0) {
+        ++epochs_done_;
+        return false;
+    }
+    features = slot_features_[slot].narrow(0, 0, slot_len_[slot]);
+    labels = slot_labels_[slot].narrow(0, 0, slot_len_[slot]);
+    return true;
+}
@@ -1,9 +1,98 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <random>
 #include <string>
+#include <thread>
 #include <torch/torch.h>
+#include <vector>
 
 std::vector<float> load_csv_to_vector(const std::string &file_path, const char &delimiter = ',');
 torch::Tensor load_csv_to_tensor(const std::string &file_path,
                                  const char &delimiter = ',',
                                  const torch::TensorOptions &ops = torch::TensorOptions().dtype(torch::kFloat32).device(torch::kCPU));
+
+// Lock-free single-producer single-consumer ring of slot ids
+// push never blocks (callers keep at most capacity-1 ids in flight), pop blocks until an id arrives
+class spsc_queue {
+public:
+    explicit spsc_queue(size_t capacity) : buf_(capacity), capacity_(capacity) {}
+
+    void push(int64_t value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        buf_[tail % capacity_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        tail_.notify_one();
+    }
+
+    int64_t pop() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        while (tail == head) {
+            tail_.wait(tail, std::memory_order_acquire);
+            tail = tail_.load(std::memory_order_acquire);
+        }
+        int64_t value = buf_[head % capacity_];
+        head_.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+private:
+    std::vector<int64_t> buf_;
+    size_t capacity_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+// Background-threaded mini-batch pipeline over loaded tensors
+// A producer thread shuffles sample indices each epoch and gathers batches into a fixed set of reusable
+// slot buffers, staying at most prefetch batches ahead of the consumer. The slots are pinned by default when CUDA
+// is available, so batches copy to the device asynchronously; pass pin_memory = false to keep pageable memory.
+// Slots travel between the threads through two spsc_queues, so the steady state allocates no batch memory.
+// An epoch ends with an empty slot and a producer failure with a marker carrying the exception, so the
+// consumer learns both through the queue.
+class batch_pipeline {
+public:
+    batch_pipeline(const torch::Tensor &features,
+                   const torch::Tensor &labels,
+                   int64_t batch_size,
+                   int64_t prefetch = 2,
+                   int64_t num_epochs = 1,
+                   bool shuffle = true,
+                   uint64_t seed = std::random_device{}(),
+                   bool pin_memory = torch::cuda::is_available());
+    ~batch_pipeline();
+
+    batch_pipeline(const batch_pipeline &) = delete;
+    batch_pipeline &operator=(const batch_pipeline &) = delete;
+
+    // Returns false at the end of each epoch; the batch views stay valid until the next call
+    bool next(torch::Tensor &features, torch::Tensor &labels);
+
+    int64_t batches_per_epoch() const { return (num_samples_ + batch_size_ - 1) / batch_size_; }
+
+private:
+    void produce();
+
+    torch::Tensor features_;
+    torch::Tensor labels_;
+    torch::Tensor perm_;
+    std::vector<torch::Tensor> slot_features_;
+    std::vector<torch::Tensor> slot_labels_;
+    std::vector<int64_t> slot_len_;
+    int64_t num_samples_;
+    int64_t batch_size_;
+    int64_t num_epochs_;
+    int64_t epochs_done_ = 0;
+    int64_t held_slot_ = -1;
+    bool failed_ = false;
+    bool shuffle_;
+    std::mt19937_64 gen_;
+    spsc_queue ready_;
+    spsc_queue free_;
+    std::atomic<bool> stop_{false};
+    std::exception_ptr error_; // written by the producer before it pushes the failure marker
+    std::thread worker_;
+};
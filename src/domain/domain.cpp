@@ -0,0 +1,376 @@
+#include "domain.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <spawn.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <type_traits>
+#include <unistd.h>
+
+extern char **environ;
+
+constexpr int32_t TENSOR_MAGIC = 0x52424e54; // "RBNT"
+constexpr int32_t STATUS_OK = 0;
+constexpr int32_t STATUS_ERROR = 1;
+constexpr int64_t MAX_TENSOR_DIM = 8;
+constexpr int64_t MAX_TENSOR_BYTES = int64_t(1) << 36; // 64 GiB, far above any subdomain
+constexpr int64_t MAX_STRING_BYTES = 1 << 20;          // field names and worker error messages
+constexpr int64_t MAX_MODELDATA_FIELDS = 1024;
+constexpr int WORKER_SOCKET_FD = 3; // first descriptor after stdin, stdout and stderr
+
+using namespace torch;
+
+static void write_exact(int fd, const void *buf, size_t len) {
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("domain: socket write failed");
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// returns false on a clean EOF before the first byte
+static bool read_exact(int fd, void *buf, size_t len) {
+    char *p = static_cast<char *>(buf);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = recv(fd, p + done, len - done, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("domain: socket read failed");
+        }
+        if (n == 0) {
+            if (done == 0)
+                return false;
+            throw std::runtime_error("domain: unexpected end of stream");
+        }
+        done += n;
+    }
+    return true;
+}
+
+template <typename T>
+static void write_value(int fd, const T &value) {
+    write_exact(fd, &value, sizeof(T));
+}
+
+template <typename T>
+static T read_value(int fd) {
+    T value;
+    if (!read_exact(fd, &value, sizeof(T)))
+        throw std::runtime_error("domain: unexpected end of stream");
+    return value;
+}
+
+// Frame: length, bytes
+static void write_string(int fd, const std::string &s) {
+    write_value<int64_t>(fd, static_cast<int64_t>(s.size()));
+    write_exact(fd, s.data(), s.size());
+}
+
+static std::string read_string(int fd) {
+    int64_t len = read_value<int64_t>(fd);
+    if (len < 0 || len > MAX_STRING_BYTES)
+        throw std::runtime_error("domain: bad string length");
+    std::string s(len, '\0');
+    if (len > 0 && !read_exact(fd, s.data(), len))
+        throw std::runtime_error("domain: unexpected end of stream");
+    return s;
+}
+
+// Frame: field count, then per field its name and its value widened to int64 or double
+// Coordinator and workers only have to agree on field names, unknown names are skipped
+static void write_modeldata(int fd, const modeldata &model_info) {
+    modeldata m = model_info;
+    int64_t count = 0;
+    visit_modeldata(m, [&](const char *, auto &) { ++count; });
+    write_value<int64_t>(fd, count);
+    visit_modeldata(m, [&](const char *name, auto &value) {
+        using T = std::decay_t<decltype(value)>;
+        write_string(fd, name);
+        if constexpr (std::is_floating_point_v<T>)
+            write_value<double>(fd, static_cast<double>(value));
+        else
+            write_value<int64_t>(fd, static_cast<int64_t>(value));
+    });
+}
+
+// returns false on a clean EOF before the frame
+static bool read_modeldata(int fd, modeldata &model_info) {
+    int64_t count;
+    if (!read_exact(fd, &count, sizeof(count)))
+        return false;
+    if (count < 0 || count > MAX_MODELDATA_FIELDS)
+        throw std::runtime_error("domain: bad modeldata frame");
+    for (int64_t f = 0; f < count; ++f) {
+        std::string key = read_string(fd);
+        char raw[8];
+        if (!read_exact(fd, raw, sizeof(raw)))
+            throw std::runtime_error("domain: unexpected end of stream");
+        visit_modeldata(model_info, [&](const char *name, auto &value) {
+            if (key != name)
+                return;
+            using T = std::decay_t<decltype(value)>;
+            if constexpr (std::is_floating_point_v<T>) {
+                double d;
+                std::memcpy(&d, raw, sizeof(d));
+                value = static_cast<T>(d);
+            } else {
+                int64_t i;
+                std::memcpy(&i, raw, sizeof(i));
+                value = static_cast<T>(i);
+            }
+        });
+    }
+    return true;
+}
+
+// dtypes the coordinator and workers exchange
+static bool wire_dtype(torch::ScalarType dtype) {
+    switch (dtype) {
+    case torch::kFloat:
+    case torch::kDouble:
+    case torch::kHalf:
+    case torch::kLong:
+    case torch::kInt:
+    case torch::kBool:
+    case torch::kByte:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Frame: magic, dtype, ndim, sizes[ndim], raw contiguous bytes
+void domain::write_tensor(int fd, const Tensor &tensor) {
+    Tensor t = tensor.to(torch::kCPU).contiguous();
+    if (!wire_dtype(t.scalar_type()))
+        throw std::runtime_error("domain: unsupported tensor dtype");
+    write_value<int32_t>(fd, TENSOR_MAGIC);
+    write_value<int32_t>(fd, static_cast<int32_t>(t.scalar_type()));
+    write_value<int64_t>(fd, t.dim());
+    for (int64_t d = 0; d < t.dim(); ++d)
+        write_value<int64_t>(fd, t.size(d));
+    write_exact(fd, t.data_ptr(), t.nbytes());
+}
+
+Tensor domain::read_tensor(int fd) {
+    if (read_value<int32_t>(fd) != TENSOR_MAGIC)
+        throw std::runtime_error("domain: bad tensor frame");
+    // the header is validated before anything is allocated from it
+    auto dtype = static_cast<torch::ScalarType>(read_value<int32_t>(fd));
+    if (!wire_dtype(dtype))
+        throw std::runtime_error("domain: bad tensor dtype");
+    int64_t ndim = read_value<int64_t>(fd);
+    if (ndim < 0 || ndim > MAX_TENSOR_DIM)
+        throw std::runtime_error("domain: bad tensor rank");
+    std::vector<int64_t> sizes(ndim);
+    int64_t nbytes = static_cast<int64_t>(c10::elementSize(dtype));
+    for (int64_t d = 0; d < ndim; ++d) {
+        sizes[d] = read_value<int64_t>(fd);
+        // checked per dimension so the running product cannot overflow
+        if (sizes[d] < 0 || (sizes[d] > 0 && nbytes > MAX_TENSOR_BYTES / sizes[d]))
+            throw std::runtime_error("domain: bad tensor size");
+        nbytes *= sizes[d];
+    }
+    Tensor t = torch::empty(sizes, torch::TensorOptions().dtype(dtype));
+    if (t.nbytes() > 0 && !read_exact(fd, t.data_ptr(), t.nbytes()))
+        throw std::runtime_error("domain: unexpected end of stream");
+    return t;
+}
+
+// Split senders into num_domains slabs of equal size along the axis of largest extent.
+// Receivers and glia are assigned to every slab whose range, widened by halo, contains them.
+// halo should be con_rad + neuron_rad: receivers are at most con_rad away from an owned sender,
+// and an occluder can only touch a ray if its centre lies within neuron_rad of that ray.
+std::vector<domain::subdomain>
+domain::partition(int64_t num_domains, float halo, const Tensor &glia_pos, const Tensor &sender_pos, const Tensor &receiver_pos) {
+    assert(num_domains > 0);
+    std::vector<subdomain> parts;
+    int64_t n = sender_pos.size(0);
+    if (n == 0)
+        return parts;
+
+    Tensor extent = std::get<0>(sender_pos.max(0)) - std::get<0>(sender_pos.min(0)); // [3]
+    int64_t axis = extent.argmax().item<int64_t>();
+
+    Tensor sender_coord = sender_pos.select(1, axis);
+    Tensor receiver_coord = receiver_pos.select(1, axis);
+    Tensor glia_coord = glia_pos.select(1, axis);
+    Tensor order = sender_coord.argsort();
+
+    for (int64_t k = 0; k < num_domains; ++k) {
+        int64_t start = k * n / num_domains;
+        int64_t end = (k + 1) * n / num_domains;
+        if (start == end)
+            continue;
+        Tensor owned = order.slice(0, start, end);
+        Tensor owned_coord = sender_coord.index_select(0, owned);
+        float lo = owned_coord.min().item<float>() - halo;
+        float hi = owned_coord.max().item<float>() + halo;
+
+        subdomain part;
+        part.sender_idx = std::get<0>(owned.sort()); // keep placement order inside the domain
+        part.receiver_idx = ((receiver_coord >= lo) & (receiver_coord <= hi)).nonzero().squeeze(1);
+        part.glia_idx = ((glia_coord >= lo) & (glia_coord <= hi)).nonzero().squeeze(1);
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+// Job: modeldata, glia_pos, sender_pos, receiver_pos (all local to the subdomain)
+// Reply: status, then WRowIdx/WColIdx in local indices or an error message
+int domain::serve_worker(int fd) {
+    raytrace tracer;
+    raytrace_workspace ws; // jobs of one worker reuse the same buffers
+    while (true) {
+        modeldata model_info{};
+        if (!read_modeldata(fd, model_info))
+            return 0; // coordinator closed the connection
+        Tensor glia_pos = read_tensor(fd);
+        Tensor sender_pos = read_tensor(fd);
+        Tensor receiver_pos = read_tensor(fd);
+        try {
+            auto [WRowIdx, WColIdx] = tracer.raytrace_distance_limited(ws, model_info, glia_pos, sender_pos, receiver_pos);
+            write_value<int32_t>(fd, STATUS_OK);
+            write_tensor(fd, WRowIdx);
+            write_tensor(fd, WColIdx);
+        } catch (const std::exception &e) {
+            write_value<int32_t>(fd, STATUS_ERROR);
+            write_string(fd, e.what());
+        }
+    }
+}
+
+std::string domain::worker_path() {
+    if (const char *env = std::getenv("RAYBNN_WORKER"))
+        return env;
+#ifdef RAYBNN_WORKER_PATH
+    return RAYBNN_WORKER_PATH;
+#else
+    return "raybnn_worker";
+#endif
+}
+
+namespace {
+// Owns one spawned worker and its socket; reaps the process on destruction
+struct worker_process {
+    pid_t pid = -1;
+    int fd = -1;
+
+    worker_process(const std::string &path, int64_t threads) {
+        // both ends are close-on-exec from creation, so workers spawned concurrently never inherit them;
+        // the child end is dup2'ed to WORKER_SOCKET_FD in the worker, which clears the flag on the copy
+        // (posix_spawn clears it as well when sv[1] already is WORKER_SOCKET_FD)
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+            throw std::runtime_error("domain: socketpair failed");
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, sv[1], WORKER_SOCKET_FD);
+
+        std::string fd_arg = std::to_string(WORKER_SOCKET_FD);
+        std::string threads_arg = std::to_string(threads);
+        std::vector<char *> argv = {const_cast<char *>(path.c_str()),
+                                    const_cast<char *>("--fd"),
+                                    fd_arg.data(),
+                                    const_cast<char *>("--threads"),
+                                    threads_arg.data(),
+                                    nullptr};
+        int rc = posix_spawn(&pid, path.c_str(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(sv[1]);
+        if (rc != 0) {
+            close(sv[0]);
+            throw std::runtime_error("domain: cannot spawn worker " + path);
+        }
+        fd = sv[0];
+    }
+
+    worker_process(const worker_process &) = delete;
+    worker_process &operator=(const worker_process &) = delete;
+
+    ~worker_process() {
+        if (fd >= 0)
+            close(fd); // EOF ends the worker loop
+        if (pid > 0) {
+            int status;
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+            }
+        }
+    }
+};
+} // namespace
+
+// Multi-process counterpart of raytrace::raytrace_distance_limited, returns global (WRowIdx, WColIdx)
+std::tuple<torch::Tensor, torch::Tensor> domain::raytrace_distance_limited(int64_t num_workers,
+                                                                           int64_t threads_per_worker,
+                                                                           const modeldata &model_info,
+                                                                           const torch::Tensor &glia_pos,
+                                                                           const torch::Tensor &sender_pos,
+                                                                           const torch::Tensor &receiver_pos,
+                                                                           const std::optional<torch::Tensor> &prev_WRowIdx,
+                                                                           const std::optional<torch::Tensor> &prev_WColIdx) {
+    Tensor glia_cpu = glia_pos.to(torch::kCPU);
+    Tensor sender_cpu = sender_pos.to(torch::kCPU);
+    Tensor receiver_cpu = receiver_pos.to(torch::kCPU);
+
+    float halo = model_info.con_rad + model_info.neuron_rad;
+    std::vector<subdomain> parts = partition(num_workers, halo, glia_cpu, sender_cpu, receiver_cpu);
+
+    std::string path = worker_path();
+    std::vector<std::unique_ptr<worker_process>> workers;
+    for (size_t k = 0; k < parts.size(); ++k)
+        workers.push_back(std::make_unique<worker_process>(path, threads_per_worker));
+
+    // each worker starts tracing as soon as its own job is fully received
+    for (size_t k = 0; k < parts.size(); ++k) {
+        int fd = workers[k]->fd;
+        write_modeldata(fd, model_info);
+        write_tensor(fd, glia_cpu.index_select(0, parts[k].glia_idx));
+        write_tensor(fd, sender_cpu.index_select(0, parts[k].sender_idx));
+        write_tensor(fd, receiver_cpu.index_select(0, parts[k].receiver_idx));
+    }
+
+    std::vector<Tensor> rows;
+    std::vector<Tensor> cols;
+    for (size_t k = 0; k < parts.size(); ++k) {
+        int fd = workers[k]->fd;
+        if (read_value<int32_t>(fd) != STATUS_OK) {
+            throw std::runtime_error("domain: worker " + std::to_string(k) + " failed: " + read_string(fd));
+        }
+        Tensor local_row = read_tensor(fd);
+        Tensor local_col = read_tensor(fd);
+        // WRowIdx indexes receivers, WColIdx indexes senders
+        rows.push_back(parts[k].receiver_idx.index_select(0, local_row));
+        cols.push_back(parts[k].sender_idx.index_select(0, local_col));
+    }
+    workers.clear();
+
+    if (prev_WRowIdx.has_value() && prev_WColIdx.has_value()) {
+        assert(prev_WColIdx.value().size(0) == prev_WRowIdx.value().size(0));
+        rows.push_back(prev_WRowIdx.value().to(torch::kCPU, torch::kLong));
+        cols.push_back(prev_WColIdx.value().to(torch::kCPU, torch::kLong));
+    }
+
+    Tensor WRowIdx = torch::empty({0}, torch::TensorOptions().dtype(torch::kLong));
+    Tensor WColIdx = torch::empty({0}, torch::TensorOptions().dtype(torch::kLong));
+    if (!rows.empty()) {
+        WRowIdx = torch::cat(rows, 0);
+        WColIdx = torch::cat(cols, 0);
+    }
+    if (WRowIdx.size(0) > 0)
+        raytrace::dedup_and_sort(WRowIdx, WColIdx);
+
+    return {WRowIdx.to(sender_pos.device()), WColIdx.to(sender_pos.device())};
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "raytrace.hpp"
+#include <cstdint>
+#include <string>
+#include <torch/torch.h>
+#include <vector>
+
+// Spatial domain decomposition of raytrace_distance_limited over local worker processes.
+// The coordinator splits the senders into slabs along the longest axis, ships each slab plus a halo of
+// receivers and glia to a raybnn_worker process, and merges the returned edge lists.
+// The wire protocol only needs a byte stream, so the same framing works over TCP sockets later on.
+class domain {
+public:
+    struct subdomain {
+        torch::Tensor sender_idx;   // senders owned by this domain (global index) [Ns]
+        torch::Tensor receiver_idx; // receivers inside the slab and its halo (global index) [Nr]
+        torch::Tensor glia_idx;     // glia inside the slab and its halo (global index) [Ng]
+    };
+
+    static std::vector<subdomain> partition(int64_t num_domains,
+                                            float halo,
+                                            const torch::Tensor &glia_pos,
+                                            const torch::Tensor &sender_pos,
+                                            const torch::Tensor &receiver_pos);
+
+    static void write_tensor(int fd, const torch::Tensor &tensor);
+    static torch::Tensor read_tensor(int fd);
+
+    // Worker loop, reads jobs from fd until the coordinator closes it
+    static int serve_worker(int fd);
+
+    static std::string worker_path();
+
+    static std::tuple<torch::Tensor, torch::Tensor> raytrace_distance_limited(int64_t num_workers,
+                                                                              int64_t threads_per_worker,
+                                                                              const modeldata &model_info,
+                                                                              const torch::Tensor &glia_pos,
+                                                                              const torch::Tensor &sender_pos,
+                                                                              const torch::Tensor &receiver_pos,
+                                                                              const std::optional<torch::Tensor> &prev_WRowIdx = std::nullopt,
+                                                                              const std::optional<torch::Tensor> &prev_WColIdx = std::nullopt);
+};
@@ -0,0 +1,48 @@
+#include "domain.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// raybnn_worker --fd N [--threads T]
+// raybnn_worker --connect /path/to/socket [--threads T]
+int main(int argc, char **argv) {
+    int fd = -1;
+    int threads = 1;
+    std::string connect_path;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--fd") == 0)
+            fd = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--threads") == 0)
+            threads = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--connect") == 0)
+            connect_path = argv[i + 1];
+    }
+
+    if (!connect_path.empty()) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, connect_path.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "raybnn_worker: cannot connect to " << connect_path << std::endl;
+            return 1;
+        }
+    }
+    if (fd < 0) {
+        std::cerr << "usage: raybnn_worker (--fd N | --connect PATH) [--threads T]" << std::endl;
+        return 1;
+    }
+
+    torch::set_num_threads(threads > 0 ? threads : 1);
+    try {
+        int rc = domain::serve_worker(fd);
+        close(fd);
+        return rc;
+    } catch (const std::exception &e) {
+        std::cerr << "raybnn_worker: " << e.what() << std::endl;
+        return 1;
+    }
+}
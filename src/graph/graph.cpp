@@ -1,4 +1,5 @@
 #include "graph.hpp"
+#include "memory_tracker.hpp"
 #include "sparse.hpp"
 using namespace torch;
 
@@ -6,6 +7,7 @@ constexpr int64_t COO_FIND_LIMIT = 150000000;
 
 // neuron_idx_in [N]
 torch::Tensor RayBNNGraph::traverse_forward(torch::Tensor &neuron_idx_in, int64_t depth, int64_t neuron_size) {
+    memory_scope scope("traversal");
     torch::Tensor out_idx = neuron_idx_in.clone();
 
     int64_t COO_batch_size = 1 + (COO_FIND_LIMIT / this->WColIdx_.size(0));
@@ -27,6 +29,7 @@ torch::Tensor RayBNNGraph::traverse_forward(torch::Tensor &neuron_idx_in, int64_
 }
 
 torch::Tensor RayBNNGraph::traverse_backward(torch::Tensor &neuron_idx_in, int64_t depth, int64_t neuron_size) {
+    memory_scope scope("traversal");
     torch::Tensor out_idx = neuron_idx_in.clone();
 
     int64_t COO_batch_size = 1 + (COO_FIND_LIMIT / this->WColIdx_.size(0));
@@ -82,6 +85,7 @@ void RayBNNGraph::delete_loops(const torch::Tensor &last_idx,
                                torch::Tensor &WRowIdxCOO,
                                torch::Tensor &WColIdx) {
     using namespace torch;
+    memory_scope scope("loop_deletion");
 
     Tensor cur_idx = last_idx.clone();
     Tensor filter_idx = torch::cat({first_idx, last_idx}, 0);
@@ -109,7 +113,8 @@ void RayBNNGraph::delete_loops(const torch::Tensor &last_idx,
                 continue;
 
             COO_batch_size = 1 + (COO_FIND_LIMIT / temp_first_idx.size(0));
-            Tensor detect_first_idx = sparse::COO_find_batch(filter_idx, temp_first_idx, COO_batch_size);
+            // positions in temp_first_idx of the neurons already in filter_idx
+            Tensor detect_first_idx = sparse::COO_find_batch(temp_first_idx, filter_idx, COO_batch_size);
 
             if (detect_first_idx.size(0) > 0) {
                 Tensor con_first_idx = temp_first_idx.index_select(0, detect_first_idx);
@@ -120,7 +125,7 @@ void RayBNNGraph::delete_loops(const torch::Tensor &last_idx,
 
                 Tensor mask = torch::ones(temp_first_idx.sizes(), torch::kBool).to(temp_first_idx.device());
                 mask.index_put_({detect_first_idx}, false);
-                Tensor tempidx = mask.nonzero().squeeze();
+                Tensor tempidx = mask.nonzero().squeeze(1);
                 if (tempidx.size(0) > 0) {
                     temp_first_idx = temp_first_idx.index_select(0, tempidx);
                 } else {
@@ -135,59 +140,65 @@ void RayBNNGraph::delete_loops(const torch::Tensor &last_idx,
         filter_idx = sparse::find_unique(filter_idx, neuron_size);
     }
 
-    if (delWRowIdxCOO.size(0) > 0)
-        delWRowIdxCOO = delWRowIdxCOO.slice(0, 1, delWRowIdxCOO.size(0));
-    if (delWColIdx.size(0) > 0)
-        delWColIdx = delWColIdx.slice(0, 1, delWColIdx.size(0));
+    // indices are handled as int64 whatever their stored dtype, which is restored on output
+    auto WValues_cpu = WValues.to(torch::kCPU, torch::kFloat).contiguous().view({-1});
+    auto WRowIdxCOO_cpu = WRowIdxCOO.to(torch::kCPU, torch::kLong).contiguous().view({-1});
+    auto WColIdx_cpu = WColIdx.to(torch::kCPU, torch::kLong).contiguous().view({-1});
+    auto gidx1_cpu = get_global_weight_idx(neuron_size, WRowIdxCOO_cpu, WColIdx_cpu);
+    auto gidx2_cpu = get_global_weight_idx(neuron_size, delWRowIdxCOO.to(torch::kCPU, torch::kLong), delWColIdx.to(torch::kCPU, torch::kLong));
 
-    Tensor gidx1 = get_global_weight_idx(neuron_size, WRowIdxCOO, WColIdx);
-    Tensor gidx2 = get_global_weight_idx(neuron_size, delWRowIdxCOO, delWColIdx);
+    std::unordered_map<int64_t, float> join_WValues;
+    std::unordered_map<int64_t, int64_t> join_WColIdx;
+    std::unordered_map<int64_t, int64_t> join_WRowIdxCOO;
 
-    auto gidx1_cpu = gidx1.to(torch::kCPU);
-    auto gidx2_cpu = gidx2.to(torch::kCPU);
-    auto WValues_cpu = WValues.to(torch::kCPU);
-    auto WRowIdxCOO_cpu = WRowIdxCOO.to(torch::kCPU);
-    auto WColIdx_cpu = WColIdx.to(torch::kCPU);
-
-    std::unordered_map<uint64_t, float> join_WValues;
-    std::unordered_map<uint64_t, int32_t> join_WColIdx;
-    std::unordered_map<uint64_t, int32_t> join_WRowIdxCOO;
-
-    auto gidx1_acc = gidx1_cpu.data_ptr<uint64_t>();
-    auto gidx2_acc = gidx2_cpu.data_ptr<uint64_t>();
+    auto gidx1_acc = gidx1_cpu.data_ptr<int64_t>();
+    auto gidx2_acc = gidx2_cpu.data_ptr<int64_t>();
     auto WValues_acc = WValues_cpu.data_ptr<float>();
-    auto WRowIdxCOO_acc = WRowIdxCOO_cpu.data_ptr<int32_t>();
-    auto WColIdx_acc = WColIdx_cpu.data_ptr<int32_t>();
+    auto WRowIdxCOO_acc = WRowIdxCOO_cpu.data_ptr<int64_t>();
+    auto WColIdx_acc = WColIdx_cpu.data_ptr<int64_t>();
 
     for (int64_t qq = 0; qq < gidx1_cpu.size(0); ++qq) {
-        uint64_t cur_gidx = gidx1_acc[qq];
+        int64_t cur_gidx = gidx1_acc[qq];
         join_WValues[cur_gidx] = WValues_acc[qq];
         join_WColIdx[cur_gidx] = WColIdx_acc[qq];
         join_WRowIdxCOO[cur_gidx] = WRowIdxCOO_acc[qq];
     }
     for (int64_t qq = 0; qq < gidx2_cpu.size(0); ++qq) {
-        uint64_t cur_gidx = gidx2_acc[qq];
+        int64_t cur_gidx = gidx2_acc[qq];
         join_WValues.erase(cur_gidx);
         join_WColIdx.erase(cur_gidx);
         join_WRowIdxCOO.erase(cur_gidx);
     }
 
-    std::vector<uint64_t> gidx3;
+    std::vector<int64_t> gidx3;
     for (const auto &kv : join_WValues)
         gidx3.push_back(kv.first);
     std::sort(gidx3.begin(), gidx3.end());
 
     std::vector<float> WValues_vec;
-    std::vector<int32_t> WColIdx_vec;
-    std::vector<int32_t> WRowIdxCOO_vec;
+    std::vector<int64_t> WColIdx_vec;
+    std::vector<int64_t> WRowIdxCOO_vec;
     for (auto qq : gidx3) {
         WValues_vec.push_back(join_WValues[qq]);
         WColIdx_vec.push_back(join_WColIdx[qq]);
         WRowIdxCOO_vec.push_back(join_WRowIdxCOO[qq]);
     }
 
-    WValues = torch::from_blob(WValues_vec.data(), {(int64_t)WValues_vec.size(), 1}, torch::TensorOptions().dtype(WValues.dtype())).clone();
-    WColIdx = torch::from_blob(WColIdx_vec.data(), {(int64_t)WColIdx_vec.size(), 1}, torch::TensorOptions().dtype(WColIdx.dtype())).clone();
-    WRowIdxCOO =
-        torch::from_blob(WRowIdxCOO_vec.data(), {(int64_t)WRowIdxCOO_vec.size(), 1}, torch::TensorOptions().dtype(WRowIdxCOO.dtype())).clone();
-}
\ No newline at end of file
+    // outputs keep the [N,1] shape, dtype and device of the baseline API
+    int64_t num_kept = static_cast<int64_t>(gidx3.size());
+    WValues = torch::from_blob(WValues_vec.data(), {num_kept, 1}, torch::TensorOptions().dtype(torch::kFloat))
+                  .clone()
+                  .to(WValues.device(), WValues.scalar_type());
+    WColIdx = torch::from_blob(WColIdx_vec.data(), {num_kept, 1}, torch::TensorOptions().dtype(torch::kLong))
+                  .clone()
+                  .to(WColIdx.device(), WColIdx.scalar_type());
+    WRowIdxCOO = torch::from_blob(WRowIdxCOO_vec.data(), {num_kept, 1}, torch::TensorOptions().dtype(torch::kLong))
+                     .clone()
+                     .to(WRowIdxCOO.device(), WRowIdxCOO.scalar_type());
+}
+
+torch::Tensor RayBNNGraph::reorder(int64_t neuron_size, torch::Tensor &cell_pos, torch::Tensor &WValues, int64_t input_size, int64_t output_size) {
+    torch::Tensor perm = sparse::reverse_cuthill_mckee(this->WRowIdx_, this->WColIdx_, neuron_size, input_size, output_size);
+    sparse::apply_permutation(perm, cell_pos, this->WRowIdx_, this->WColIdx_, WValues);
+    return perm;
+}
@@ -9,6 +9,16 @@ private:
     torch::Tensor WColIdx_;
 
 public:
+    RayBNNGraph() = default;
+    RayBNNGraph(const torch::Tensor &WRowIdx, const torch::Tensor &WColIdx) : WRowIdx_(WRowIdx), WColIdx_(WColIdx) {}
+
+    void set_edges(const torch::Tensor &WRowIdx, const torch::Tensor &WColIdx) {
+        WRowIdx_ = WRowIdx;
+        WColIdx_ = WColIdx;
+    }
+    const torch::Tensor &WRowIdx() const { return WRowIdx_; }
+    const torch::Tensor &WColIdx() const { return WColIdx_; }
+
     torch::Tensor traverse_forward(torch::Tensor &idx_in, int64_t depth, int64_t neuron_size);
     torch::Tensor traverse_backward(torch::Tensor &idx_in, int64_t depth, int64_t neuron_size);
     torch::Tensor delete_loops();
@@ -22,6 +32,10 @@ public:
                       torch::Tensor &WRowIdxCOO,
                       torch::Tensor &WColIdx);
 
+    // RCM renumbering of the stored edges, applied to cell_pos and WValues as well; returns perm[new_idx] = old_idx
+    // The first input_size and last output_size neurons keep their index
+    torch::Tensor reorder(int64_t neuron_size, torch::Tensor &cell_pos, torch::Tensor &WValues, int64_t input_size = 0, int64_t output_size = 0);
+
     torch::Tensor get_global_weight_idx(int64_t neuron_size, const torch::Tensor &WRowIdxCOO, const torch::Tensor &WColIdx) {
         return WRowIdxCOO * neuron_size + WColIdx;
     }
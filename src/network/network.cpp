@@ -0,0 +1,134 @@
+#include "network.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace torch;
+
+// Weights are drawn from N(0, neuron_std), or N(0, 1/sqrt(fan_in)) when neuron_std is not set
+network::network(const modeldata &model_info, const Tensor &WRowIdx, const Tensor &WColIdx, uint64_t seed)
+    : model_info(model_info), WRowIdx(WRowIdx.to(torch::kLong)), WColIdx(WColIdx.to(torch::kLong)) {
+    assert(WRowIdx.size(0) == WColIdx.size(0));
+    auto gen = at::detail::createCPUGenerator(seed);
+    int64_t num_edges = WRowIdx.size(0);
+    double weight_std = model_info.neuron_std;
+    if (weight_std <= 0.0) {
+        double fan_in = num_edges / static_cast<double>(std::max<int64_t>(model_info.neuron_size, 1));
+        weight_std = 1.0 / std::sqrt(std::max(fan_in, 1.0));
+    }
+    WValues = at::normal(0.0, weight_std, {num_edges}, gen, torch::dtype(torch::kFloat32)).to(WRowIdx.device());
+    bias = torch::zeros({model_info.neuron_size}, torch::dtype(torch::kFloat32).device(WRowIdx.device()));
+    prepare();
+}
+
+// Set a modeldata field from its text form, e.g. ("con_rad", "1.5"); returns false for an unknown name
+// and throws std::invalid_argument for a malformed value
+bool set_modeldata_field(modeldata &model_info, const std::string &key, const std::string &value) {
+    bool found = false;
+    visit_modeldata(model_info, [&](const char *name, auto &field) {
+        if (key != name)
+            return;
+        found = true;
+        using T = std::decay_t<decltype(field)>;
+        if constexpr (std::is_same_v<T, bool>) {
+            if (value == "true" || value == "1")
+                field = true;
+            else if (value == "false" || value == "0")
+                field = false;
+            else
+                throw std::invalid_argument("modeldata: " + key + " expects true or false, got " + value);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            field = static_cast<T>(std::stod(value));
+        } else {
+            field = static_cast<T>(std::stoll(value));
+        }
+    });
+    return found;
+}
+
+void network::save(const std::string &file_path) const {
+    torch::serialize::OutputArchive archive;
+    modeldata m = model_info;
+    visit_modeldata(m, [&](const char *key, auto &value) {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, bool>)
+            archive.write(std::string("model_info.") + key, c10::IValue(value));
+        else if constexpr (std::is_floating_point_v<T>)
+            archive.write(std::string("model_info.") + key, c10::IValue(static_cast<double>(value)));
+        else
+            archive.write(std::string("model_info.") + key, c10::IValue(static_cast<int64_t>(value)));
+    });
+    archive.write("WRowIdx", WRowIdx.to(torch::kCPU));
+    archive.write("WColIdx", WColIdx.to(torch::kCPU));
+    archive.write("WValues", WValues.to(torch::kCPU));
+    archive.write("bias", bias.to(torch::kCPU));
+    archive.save_to(file_path);
+}
+
+network network::load(const std::string &file_path) {
+    torch::serialize::InputArchive archive;
+    archive.load_from(file_path);
+    network net;
+    visit_modeldata(net.model_info, [&](const char *key, auto &value) {
+        using T = std::decay_t<decltype(value)>;
+        c10::IValue ivalue;
+        if (!archive.try_read(std::string("model_info.") + key, ivalue))
+            return; // written before the field existed, keep the default
+        if constexpr (std::is_same_v<T, bool>)
+            value = ivalue.toBool();
+        else if constexpr (std::is_floating_point_v<T>)
+            value = static_cast<T>(ivalue.toDouble());
+        else
+            value = static_cast<T>(ivalue.toInt());
+    });
+    archive.read("WRowIdx", net.WRowIdx);
+    archive.read("WColIdx", net.WColIdx);
+    archive.read("WValues", net.WValues);
+    archive.read("bias", net.bias);
+    if (net.WRowIdx.size(0) != net.WValues.size(0) || net.bias.size(0) != net.model_info.neuron_size)
+        throw std::runtime_error("network: inconsistent archive " + file_path);
+    net.prepare();
+    return net;
+}
+
+void network::prepare() {
+    int64_t n = model_info.neuron_size;
+    if (WValues.device().is_cpu()) {
+        // placement order scatters neighbours across the matrix, RCM packs the local connectivity into
+        // blocks near the diagonal; the stored edges keep their numbering and only the product is renumbered
+        perm = sparse::reverse_cuthill_mckee(WRowIdx, WColIdx, n, model_info.input_size, model_info.output_size);
+        Tensor inv = sparse::inverse_permutation(perm);
+        W_blocks_ = block_sparse::build(inv.index_select(0, WRowIdx), inv.index_select(0, WColIdx), WValues, n);
+        perm_bias_ = bias.index_select(0, perm);
+        W_ = Tensor();
+        return;
+    }
+    perm = Tensor();
+    perm_bias_ = Tensor();
+    W_blocks_ = block_sparse();
+    Tensor indices = torch::stack({WRowIdx.to(torch::kLong), WColIdx.to(torch::kLong)}, 0); // [2, E]
+    W_ = torch::sparse_coo_tensor(indices, WValues, {n, n}).coalesce();
+}
+
+// Sparse recurrent update over proc_num steps, the inputs are clamped onto the input neurons every step
+// On CPU the state is in perm order, which leaves the input and output rows where they are
+// X [B, input_size]
+// output [B, output_size]
+Tensor network::forward(const Tensor &X) const {
+    assert(X.dim() == 2 && X.size(1) == model_info.input_size);
+    assert(W_.defined() || W_blocks_.defined());
+    int64_t n = model_info.neuron_size;
+    int64_t batch = X.size(0);
+    Tensor X_t = X.to(WValues.device(), torch::kFloat32).t(); // [input_size, B]
+    Tensor state = torch::zeros({n, batch}, X_t.options()); // [N, B]
+    Tensor bias_col = (W_blocks_.defined() ? perm_bias_ : bias).unsqueeze(1); // [N, 1]
+
+    for (int64_t step = 0; step < model_info.proc_num; ++step) {
+        state.slice(0, 0, model_info.input_size).copy_(X_t);
+        Tensor WZ = W_blocks_.defined() ? W_blocks_.matmul(state) : torch::mm(W_, state);
+        state = torch::tanh(WZ + bias_col);
+    }
+    return state.slice(0, n - model_info.output_size, n).t().contiguous();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "block_sparse.hpp"
+#include "raytrace.hpp"
+#include "sparse.hpp"
+#include <cstdint>
+#include <string>
+#include <torch/torch.h>
+
+bool set_modeldata_field(modeldata &model_info, const std::string &key, const std::string &value);
+
+// A built network: model parameters, the connectivity from raytracing and its weights
+// Neurons 0..input_size are the inputs and the last output_size neurons are the outputs.
+// WRowIdx indexes receivers and WColIdx indexes senders, as produced by raytrace_distance_limited.
+class network {
+public:
+    modeldata model_info{};
+    torch::Tensor WRowIdx; // [E]
+    torch::Tensor WColIdx; // [E]
+    torch::Tensor WValues; // [E]
+    torch::Tensor bias;    // [neuron_size]
+    // [neuron_size] perm[new_idx] = old_idx, the RCM order the CPU weight matrix is built in, set by prepare
+    // Inputs and outputs keep their index, so only the hidden state of forward is renumbered
+    torch::Tensor perm;
+
+    network() = default;
+    network(const modeldata &model_info, const torch::Tensor &WRowIdx, const torch::Tensor &WColIdx, uint64_t seed = 0);
+
+    void save(const std::string &file_path) const;
+    static network load(const std::string &file_path);
+
+    // Build the weight matrix used by forward, call again after changing the edges or weights
+    // On CPU the block-sparse format is used on the RCM renumbered neurons, elsewhere a torch sparse COO tensor
+    void prepare();
+
+    torch::Tensor forward(const torch::Tensor &X) const;
+
+    // CPU weight matrix, undefined before prepare or on other devices
+    const block_sparse &blocks() const { return W_blocks_; }
+
+private:
+    torch::Tensor W_; // sparse [neuron_size, neuron_size]
+    block_sparse W_blocks_;
+    torch::Tensor perm_bias_; // bias in perm order
+};
@@ -0,0 +1,267 @@
+// Python extension exposing cells, raytrace, RayBNNGraph and the dataloader
+// torch.Tensor arguments and results cross the boundary through the libtorch type caster,
+// which shares the underlying storage, so no positions or edge lists are copied.
+// Long-running construction calls release the GIL.
+#include "cells.hpp"
+#include "dataloader.hpp"
+#include "graph.hpp"
+#include "raytrace.hpp"
+#include <memory>
+#include <optional>
+#include <torch/extension.h>
+
+namespace py = pybind11;
+
+using release_gil = py::call_guard<py::gil_scoped_release>;
+
+PYBIND11_MODULE(raybnn, m) {
+    m.doc() = "RayBNN network construction";
+
+    py::class_<modeldata>(m, "modeldata")
+        .def(py::init<>())
+        .def_readwrite("neuron_size", &modeldata::neuron_size)
+        .def_readwrite("input_size", &modeldata::input_size)
+        .def_readwrite("output_size", &modeldata::output_size)
+        .def_readwrite("proc_num", &modeldata::proc_num)
+        .def_readwrite("active_size", &modeldata::active_size)
+        .def_readwrite("batch_size", &modeldata::batch_size)
+        .def_readwrite("ray_input_connection_num", &modeldata::ray_input_connection_num)
+        .def_readwrite("ray_max_rounds", &modeldata::ray_max_rounds)
+        .def_readwrite("ray_glia_intersect", &modeldata::ray_glia_intersect)
+        .def_readwrite("ray_neuron_intersect", &modeldata::ray_neuron_intersect)
+        .def_readwrite("neuron_rad", &modeldata::neuron_rad)
+        .def_readwrite("time_step", &modeldata::time_step)
+        .def_readwrite("nration", &modeldata::nration)
+        .def_readwrite("neuron_std", &modeldata::neuron_std)
+        .def_readwrite("sphere_rad", &modeldata::sphere_rad)
+        .def_readwrite("con_rad", &modeldata::con_rad)
+        .def_readwrite("ray_coverage_schedule", &modeldata::ray_coverage_schedule)
+        .def_readwrite("ray_low_precision", &modeldata::ray_low_precision)
+        .def_readwrite("ray_spill_bytes", &modeldata::ray_spill_bytes)
+        .def_readwrite("ray_spill_mmap", &modeldata::ray_spill_mmap)
+        .def_readwrite("ray_pair_memo", &modeldata::ray_pair_memo);
+
+    py::class_<cells>(m, "cells")
+        .def(py::init<>())
+        .def(
+            "specify_device",
+            [](cells &self, const std::string &device) {
+                self.specify_tensor_options(torch::TensorOptions().dtype(torch::kFloat32).device(device));
+            },
+            py::arg("device"))
+        .def("sphere_even", &cells::sphere_even, py::arg("nums"), py::arg("sphere_radius"), release_gil())
+        .def("ball_random", &cells::ball_random, py::arg("nums"), py::arg("sphere_radius"), release_gil())
+        .def("find_in_cube", &cells::find_in_cube, py::arg("points"), py::arg("pivot"), py::arg("length"), release_gil())
+        .def("select_overlap", &cells::select_overlap, py::arg("points"), py::arg("neuron_rad"), release_gil())
+        .def("check_all_collision_minibatch",
+             &cells::check_all_collision_minibatch,
+             py::arg("cell_pos"),
+             py::arg("sphere_rad"),
+             py::arg("neuron_rad"),
+             release_gil())
+        .def("generate_pivot_tensor", &cells::generate_pivot_tensor, py::arg("sphere_rad"), py::arg("step"), release_gil())
+        .def("split_into_glia_neuron", &cells::split_into_glia_neuron, py::arg("ratio"), py::arg("cell_pos"), release_gil());
+
+    py::class_<raytrace_workspace, std::shared_ptr<raytrace_workspace>>(m, "raytrace_workspace").def(py::init<>());
+
+    py::class_<pair_memo_stats>(m, "pair_memo_stats")
+        .def_readonly("queried", &pair_memo_stats::queried)
+        .def_readonly("hits", &pair_memo_stats::hits)
+        .def_property_readonly("hit_rate", &pair_memo_stats::hit_rate);
+
+    py::class_<raytrace>(m, "raytrace")
+        .def(py::init<>())
+        .def_readonly("memo_stats", &raytrace::memo_stats)
+        .def_static("filter_rays", &raytrace::filter_rays, release_gil())
+        .def_static("rays_from_neuronsA_to_neuronsB", &raytrace::rays_from_neuronsA_to_neuronsB, release_gil())
+        .def_static("line_sphere_intersect", &raytrace::line_sphere_intersect, release_gil())
+        .def_static("line_sphere_intersect_mixed", &raytrace::line_sphere_intersect_mixed, release_gil())
+        .def_static(
+            "dedup_and_sort",
+            [](torch::Tensor WRowIdx, torch::Tensor WColIdx) {
+                raytrace::dedup_and_sort(WRowIdx, WColIdx);
+                return std::make_tuple(WRowIdx, WColIdx);
+            },
+            release_gil())
+        .def("raytrace_distance_limited",
+             py::overload_cast<const modeldata &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const std::optional<torch::Tensor> &,
+                               const std::optional<torch::Tensor> &>(&raytrace::raytrace_distance_limited),
+             py::arg("model_info"),
+             py::arg("glia_pos"),
+             py::arg("sender_pos"),
+             py::arg("receiver_pos"),
+             py::arg("prev_WRowIdx") = py::none(),
+             py::arg("prev_WColIdx") = py::none(),
+             release_gil())
+        .def(
+            "raytrace_distance_limited_ws",
+            [](raytrace &self,
+               raytrace_workspace &ws,
+               const modeldata &model_info,
+               const torch::Tensor &glia_pos,
+               const torch::Tensor &sender_pos,
+               const torch::Tensor &receiver_pos,
+               const std::optional<torch::Tensor> &prev_WRowIdx,
+               const std::optional<torch::Tensor> &prev_WColIdx) {
+                return self.raytrace_distance_limited(ws, model_info, glia_pos, sender_pos, receiver_pos, prev_WRowIdx, prev_WColIdx);
+            },
+            py::arg("ws"),
+            py::arg("model_info"),
+            py::arg("glia_pos"),
+            py::arg("sender_pos"),
+            py::arg("receiver_pos"),
+            py::arg("prev_WRowIdx") = py::none(),
+            py::arg("prev_WColIdx") = py::none(),
+            release_gil())
+        .def("raytrace_incremental",
+             py::overload_cast<const modeldata &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const torch::Tensor &,
+                               const std::optional<torch::Tensor> &>(&raytrace::raytrace_incremental),
+             py::arg("model_info"),
+             py::arg("glia_pos"),
+             py::arg("sender_pos"),
+             py::arg("receiver_pos"),
+             py::arg("prev_WRowIdx"),
+             py::arg("prev_WColIdx"),
+             py::arg("new_receiver_idx"),
+             py::arg("removed_receiver_idx") = py::none(),
+             release_gil())
+        // classes is a list of (sender, receiver) population indices
+        .def(
+            "raytrace_fused",
+            [](raytrace &self,
+               const modeldata &model_info,
+               const torch::Tensor &glia_pos,
+               const std::vector<torch::Tensor> &populations,
+               const std::vector<std::pair<int64_t, int64_t>> &classes) {
+                std::vector<connection_class> fused;
+                for (const auto &[sender, receiver] : classes)
+                    fused.push_back({sender, receiver});
+                return self.raytrace_fused(model_info, glia_pos, populations, fused);
+            },
+            py::arg("model_info"),
+            py::arg("glia_pos"),
+            py::arg("populations"),
+            py::arg("classes"),
+            release_gil())
+        .def(
+            "raytrace_fused_ws",
+            [](raytrace &self,
+               raytrace_workspace &ws,
+               const modeldata &model_info,
+               const torch::Tensor &glia_pos,
+               const std::vector<torch::Tensor> &populations,
+               const std::vector<std::pair<int64_t, int64_t>> &classes) {
+                std::vector<connection_class> fused;
+                for (const auto &[sender, receiver] : classes)
+                    fused.push_back({sender, receiver});
+                return self.raytrace_fused(ws, model_info, glia_pos, populations, fused);
+            },
+            py::arg("ws"),
+            py::arg("model_info"),
+            py::arg("glia_pos"),
+            py::arg("populations"),
+            py::arg("classes"),
+            release_gil());
+
+    py::class_<RayBNNGraph>(m, "RayBNNGraph")
+        .def(py::init<>())
+        .def(py::init<const torch::Tensor &, const torch::Tensor &>(), py::arg("WRowIdx"), py::arg("WColIdx"))
+        .def("set_edges", &RayBNNGraph::set_edges)
+        .def_property_readonly("WRowIdx", &RayBNNGraph::WRowIdx)
+        .def_property_readonly("WColIdx", &RayBNNGraph::WColIdx)
+        .def("traverse_forward", &RayBNNGraph::traverse_forward, py::arg("idx_in"), py::arg("depth"), py::arg("neuron_size"), release_gil())
+        .def("traverse_backward", &RayBNNGraph::traverse_backward, py::arg("idx_in"), py::arg("depth"), py::arg("neuron_size"), release_gil())
+        .def("check_connected",
+             &RayBNNGraph::check_connected,
+             py::arg("in_idx"),
+             py::arg("out_idx"),
+             py::arg("neuron_size"),
+             py::arg("depth"),
+             release_gil())
+        .def(
+            "delete_loops",
+            [](RayBNNGraph &self,
+               const torch::Tensor &last_idx,
+               const torch::Tensor &first_idx,
+               int64_t neuron_size,
+               int64_t depth,
+               torch::Tensor WValues,
+               torch::Tensor WRowIdxCOO,
+               torch::Tensor WColIdx) {
+                self.delete_loops(last_idx, first_idx, neuron_size, depth, WValues, WRowIdxCOO, WColIdx);
+                return std::make_tuple(WValues, WRowIdxCOO, WColIdx);
+            },
+            py::arg("last_idx"),
+            py::arg("first_idx"),
+            py::arg("neuron_size"),
+            py::arg("depth"),
+            py::arg("WValues"),
+            py::arg("WRowIdxCOO"),
+            py::arg("WColIdx"),
+            release_gil())
+        .def(
+            "reorder",
+            [](RayBNNGraph &self,
+               int64_t neuron_size,
+               torch::Tensor cell_pos,
+               std::optional<torch::Tensor> WValues,
+               int64_t input_size,
+               int64_t output_size) {
+                // no weights yet: reorder takes an undefined tensor and None goes back to Python
+                torch::Tensor values = WValues.value_or(torch::Tensor());
+                torch::Tensor perm = self.reorder(neuron_size, cell_pos, values, input_size, output_size);
+                std::optional<torch::Tensor> permuted_values;
+                if (values.defined())
+                    permuted_values = values;
+                return std::make_tuple(perm, cell_pos, permuted_values);
+            },
+            py::arg("neuron_size"),
+            py::arg("cell_pos"),
+            py::arg("WValues") = py::none(),
+            py::arg("input_size") = 0,
+            py::arg("output_size") = 0,
+            release_gil());
+
+    m.def(
+        "load_csv_to_tensor",
+        [](const std::string &file_path, char delimiter) { return load_csv_to_tensor(file_path, delimiter); },
+        py::arg("file_path"),
+        py::arg("delimiter") = ',',
+        release_gil());
+
+    // iterating yields (features, labels) views into reusable buffers, valid until the next step
+    py::class_<batch_pipeline>(m, "batch_pipeline")
+        .def(py::init<const torch::Tensor &, const torch::Tensor &, int64_t, int64_t, int64_t, bool, uint64_t, bool>(),
+             py::arg("features"),
+             py::arg("labels"),
+             py::arg("batch_size"),
+             py::arg("prefetch") = 2,
+             py::arg("num_epochs") = 1,
+             py::arg("shuffle") = true,
+             py::arg("seed") = 0,
+             py::arg("pin_memory") = torch::cuda::is_available())
+        .def("batches_per_epoch", &batch_pipeline::batches_per_epoch)
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", [](batch_pipeline &self) {
+            torch::Tensor features;
+            torch::Tensor labels;
+            bool more;
+            {
+                py::gil_scoped_release release;
+                more = self.next(features, labels);
+            }
+            if (!more)
+                throw py::stop_iteration();
+            return std::make_tuple(features, labels);
+        });
+}
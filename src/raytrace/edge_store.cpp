@@ -0,0 +1,173 @@
+#include "edge_store.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+constexpr size_t MERGE_BUFFER_KEYS = 1 << 16; // per run and per output file
+
+using namespace torch;
+
+namespace {
+std::atomic<int64_t> store_counter{0};
+
+struct file_closer {
+    void operator()(FILE *f) const { std::fclose(f); }
+};
+using file_ptr = std::unique_ptr<FILE, file_closer>;
+
+file_ptr open_file(const std::string &path, const char *mode) {
+    file_ptr f(std::fopen(path.c_str(), mode));
+    if (!f)
+        throw std::runtime_error("edge_store: cannot open " + path);
+    return f;
+}
+
+void write_keys(FILE *f, const int64_t *keys, size_t n, const std::string &path) {
+    if (n > 0 && std::fwrite(keys, sizeof(int64_t), n, f) != n)
+        throw std::runtime_error("edge_store: write failed on " + path + " (disk full?)");
+}
+
+// buffered sequential reader over one run
+struct run_reader {
+    file_ptr file;
+    std::vector<int64_t> buf;
+    size_t pos = 0;
+    size_t len = 0;
+
+    bool refill() {
+        len = std::fread(buf.data(), sizeof(int64_t), buf.size(), file.get());
+        pos = 0;
+        return len > 0;
+    }
+};
+
+// buffered writer of one output column
+struct key_writer {
+    std::string path;
+    file_ptr file;
+    std::vector<int64_t> buf;
+
+    explicit key_writer(const std::string &p) : path(p), file(open_file(p, "wb")) { buf.reserve(MERGE_BUFFER_KEYS); }
+
+    void push(int64_t v) {
+        buf.push_back(v);
+        if (buf.size() == MERGE_BUFFER_KEYS)
+            flush();
+    }
+    void flush() {
+        write_keys(file.get(), buf.data(), buf.size(), path);
+        buf.clear();
+    }
+    void finish() {
+        flush();
+        if (std::fflush(file.get()) != 0)
+            throw std::runtime_error("edge_store: write failed on " + path + " (disk full?)");
+    }
+};
+
+Tensor read_back(const std::string &path, int64_t n, bool map) {
+    if (n == 0)
+        return torch::empty({0}, torch::dtype(torch::kLong));
+    if (!map) {
+        Tensor t = torch::empty({n}, torch::dtype(torch::kLong));
+        file_ptr f = open_file(path, "rb");
+        if (std::fread(t.data_ptr<int64_t>(), sizeof(int64_t), n, f.get()) != static_cast<size_t>(n))
+            throw std::runtime_error("edge_store: short read on " + path);
+        return t;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("edge_store: cannot open " + path);
+    size_t bytes = static_cast<size_t>(n) * sizeof(int64_t);
+    // private mapping: the tensor stays writable without touching the file, which is unlinked by the caller
+    void *addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error("edge_store: cannot mmap " + path);
+    return torch::from_blob(addr, {n}, [bytes](void *p) { munmap(p, bytes); }, torch::dtype(torch::kLong));
+}
+} // namespace
+
+std::string edge_store::default_dir() {
+    if (const char *env = std::getenv("RAYBNN_SPILL_DIR"))
+        return env;
+    return std::filesystem::temp_directory_path().string();
+}
+
+edge_store::edge_store(int64_t num_cols, const std::string &dir) : num_cols_(num_cols) {
+    assert(num_cols > 0);
+    prefix_ = (std::filesystem::path(dir) / ("raybnn_edges_" + std::to_string(getpid()) + "_" + std::to_string(store_counter++))).string();
+}
+
+edge_store::~edge_store() {
+    for (const std::string &run : runs_)
+        std::remove(run.c_str());
+    // left behind only if a merge failed
+    std::remove((prefix_ + "_rows.bin").c_str());
+    std::remove((prefix_ + "_cols.bin").c_str());
+}
+
+void edge_store::spill(const Tensor &WRowIdx, const Tensor &WColIdx) {
+    assert(WRowIdx.size(0) == WColIdx.size(0));
+    if (WRowIdx.size(0) == 0)
+        return;
+    Tensor keys = (WRowIdx.to(torch::kCPU, torch::kLong) * num_cols_ + WColIdx.to(torch::kCPU, torch::kLong)).contiguous();
+    std::string path = prefix_ + "_run" + std::to_string(runs_.size()) + ".bin";
+    file_ptr f = open_file(path, "wb");
+    runs_.push_back(path); // removed by the destructor even if the write fails
+    write_keys(f.get(), keys.data_ptr<int64_t>(), keys.size(0), path);
+    if (std::fflush(f.get()) != 0)
+        throw std::runtime_error("edge_store: write failed on " + path + " (disk full?)");
+    spilled_edges_ += keys.size(0);
+}
+
+std::tuple<Tensor, Tensor> edge_store::merge(bool map) {
+    std::vector<run_reader> readers(runs_.size());
+    using entry = std::pair<int64_t, size_t>; // key, run
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> heap;
+    for (size_t r = 0; r < runs_.size(); ++r) {
+        readers[r].file = open_file(runs_[r], "rb");
+        readers[r].buf.resize(MERGE_BUFFER_KEYS);
+        if (readers[r].refill())
+            heap.push({readers[r].buf[0], r});
+    }
+
+    std::string row_path = prefix_ + "_rows.bin";
+    std::string col_path = prefix_ + "_cols.bin";
+    int64_t count = 0;
+    {
+        key_writer rows(row_path);
+        key_writer cols(col_path);
+        int64_t last = -1;
+        while (!heap.empty()) {
+            auto [key, r] = heap.top();
+            heap.pop();
+            if (key != last) {
+                rows.push(key / num_cols_);
+                cols.push(key % num_cols_);
+                last = key;
+                count++;
+            }
+            run_reader &reader = readers[r];
+            if (++reader.pos < reader.len || reader.refill())
+                heap.push({reader.buf[reader.pos], r});
+        }
+        rows.finish();
+        cols.finish();
+    }
+    readers.clear();
+
+    Tensor WRowIdx = read_back(row_path, count, map);
+    Tensor WColIdx = read_back(col_path, count, map);
+    std::remove(row_path.c_str());
+    std::remove(col_path.c_str());
+    return {WRowIdx, WColIdx};
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <torch/torch.h>
+#include <vector>
+
+// Out-of-core accumulation of an edge list as external sorted runs
+// Each spill writes one run of unique (row, col) keys, row * num_cols + col, to a file in dir.
+// merge k-way merges the runs with duplicate elimination into WRowIdx/WColIdx files that are read back
+// or mmapped, so the peak memory is the merge buffers instead of the whole edge list.
+// Run and result files are removed by the destructor or as soon as they are mapped.
+class edge_store {
+public:
+    edge_store(int64_t num_cols, const std::string &dir = default_dir());
+    ~edge_store();
+
+    edge_store(const edge_store &) = delete;
+    edge_store &operator=(const edge_store &) = delete;
+
+    // WRowIdx/WColIdx [E] sorted by (row, col) without duplicates, as produced by dedup_and_sort
+    void spill(const torch::Tensor &WRowIdx, const torch::Tensor &WColIdx);
+
+    int64_t num_runs() const { return static_cast<int64_t>(runs_.size()); }
+    int64_t spilled_edges() const { return spilled_edges_; }
+
+    // Output (WRowIdx, WColIdx) [E] int64 on CPU, sorted and deduplicated; mmapped copy-on-write when map is set
+    std::tuple<torch::Tensor, torch::Tensor> merge(bool map = false);
+
+    // $RAYBNN_SPILL_DIR, else the system temporary directory
+    static std::string default_dir();
+
+private:
+    int64_t num_cols_;
+    std::string prefix_;
+    std::vector<std::string> runs_;
+    int64_t spilled_edges_ = 0;
+};
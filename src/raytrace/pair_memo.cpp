@@ -0,0 +1,37 @@
+#include "pair_memo.hpp"
+#include <cassert>
+
+using namespace torch;
+
+pair_memo::pair_memo(int64_t num_rows, int64_t num_cols, const torch::Device &device, int64_t dense_limit)
+    : num_cols_(num_cols), dense_(num_rows * num_cols <= dense_limit) {
+    assert(num_rows >= 0 && num_cols >= 0);
+    auto opts = torch::TensorOptions().device(device);
+    if (dense_)
+        visited_ = torch::zeros({(num_rows * num_cols + PAIR_MEMO_WORD_BITS - 1) / PAIR_MEMO_WORD_BITS}, opts.dtype(torch::kLong));
+    else
+        visited_ = torch::empty({0}, opts.dtype(torch::kLong));
+}
+
+Tensor pair_memo::test_and_set(const Tensor &row, const Tensor &col) {
+    assert(row.size(0) == col.size(0));
+    Tensor key = row.to(torch::kLong) * num_cols_ + col.to(torch::kLong); // [E]
+    Tensor seen;
+    if (dense_) {
+        Tensor word = torch::div(key, PAIR_MEMO_WORD_BITS, "floor");
+        Tensor bit = torch::bitwise_left_shift(torch::ones_like(key), key.remainder(PAIR_MEMO_WORD_BITS));
+        seen = visited_.index_select(0, word).bitwise_and_(bit).ne(0);
+        // pairs are distinct, so adding the bits not set yet is the same as or-ing them into their words
+        visited_.index_add_(0, word, bit.masked_fill_(seen, 0));
+    } else if (visited_.size(0) == 0) {
+        seen = torch::zeros({key.size(0)}, key.options().dtype(torch::kBool));
+        visited_ = std::get<0>(key.sort());
+    } else {
+        Tensor pos = torch::searchsorted(visited_, key).clamp_max_(visited_.size(0) - 1);
+        seen = visited_.index_select(0, pos).eq(key);
+        visited_ = std::get<0>(torch::cat({visited_, key.masked_select(seen.logical_not())}, 0).sort());
+    }
+    stats_.queried += key.size(0);
+    stats_.hits += seen.sum().item<int64_t>();
+    return seen;
+}
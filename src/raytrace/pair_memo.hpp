@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <torch/torch.h>
+
+constexpr int64_t PAIR_MEMO_DENSE_LIMIT = int64_t(1) << 28; // pairs, one bit each (32 MiB)
+constexpr int64_t PAIR_MEMO_WORD_BITS = 63;                  // bits used per int64 word, the sign bit stays clear
+
+struct pair_memo_stats {
+    int64_t queried = 0; // pairs looked up
+    int64_t hits = 0;    // pairs already traced by an earlier round
+    double hit_rate() const { return queried > 0 ? static_cast<double>(hits) / queried : 0.0; }
+};
+
+// Exact set of the (row, col) pairs already traced, so overlapping rounds skip them before any occlusion test
+// Up to dense_limit possible pairs it is a bitset over row * num_cols + col packed into int64 words, above that
+// a sorted key tensor probed with searchsorted, which only grows with the pairs actually traced.
+class pair_memo {
+public:
+    pair_memo(int64_t num_rows, int64_t num_cols, const torch::Device &device, int64_t dense_limit = PAIR_MEMO_DENSE_LIMIT);
+
+    // row [E], col [E] without repeated pairs; output mask [E] of the pairs seen by an earlier call,
+    // all of them are marked as seen afterwards
+    torch::Tensor test_and_set(const torch::Tensor &row, const torch::Tensor &col);
+
+    bool dense() const { return dense_; }
+    const pair_memo_stats &stats() const { return stats_; }
+
+private:
+    int64_t num_cols_;
+    bool dense_;
+    torch::Tensor visited_; // dense: [ceil(num_rows * num_cols / PAIR_MEMO_WORD_BITS)] bit words, sparse: sorted keys [K]
+    pair_memo_stats stats_;
+};
@@ -1,7 +1,16 @@
 #include "raytrace.hpp"
+#include "edge_store.hpp"
+#include "memory_tracker.hpp"
+#include "pair_memo.hpp"
+#include "spatial_grid.hpp"
 #include <ATen/core/TensorBody.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <random>
 
 constexpr int64_t PRUNE_COUNT_LIMIT = 10000000;
@@ -9,6 +18,11 @@ constexpr int64_t RAYTRACE_LIMIT = 10000000;
 constexpr int64_t MAX_ALLOWED_HITS_NEURON = 2;
 constexpr int64_t MAX_ALLOWED_HITS_GLIA = 0;
 constexpr int64_t MAX_SAME_COUNTER = 5;
+constexpr float LOWP_MARGIN_FACTOR = 1.0f / 64.0f; // 16 float16 ulps (2^-10 each) per unit of coordinate magnitude
+constexpr float LOWP_MIN_BOUND = 4.0f;
+constexpr float LOWP_MAX_BOUND = 128.0f;
+constexpr float LOWP_MIN_LEN_SQ = 1.0f / 1024.0f; // shorter rays are re-tested in float32 entirely
+constexpr float COVERAGE_REACH_SLACK = 1.001f; // absorbs rounding when points are binned into coverage tiles
 
 using namespace torch;
 
@@ -20,6 +34,7 @@ using namespace torch;
 // Output res_pos [M,3] and res_idx [M,1] where M is the number of rays that pass the filter
 std::pair<torch::Tensor, torch::Tensor>
 raytrace::filter_rays(const float con_rad, const torch::Tensor &target_pos, const torch::Tensor &input_pos, const torch::Tensor &input_idx) {
+    memory_scope scope("filter");
     Tensor diff = input_pos - target_pos;
     Tensor dist_squared = diff.pow(2).sum(1);
     Tensor mask = dist_squared < con_rad * con_rad;
@@ -36,6 +51,7 @@ std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor> raytrace:
                                                                                                                 const torch::Tensor &pos_B,
                                                                                                                 const torch::Tensor &idx_A,
                                                                                                                 const torch::Tensor &idx_B) {
+    memory_scope scope("pair_generation");
     int64_t N = pos_A.size(0);
     int64_t M = pos_B.size(0);
 
@@ -79,6 +95,18 @@ Tensor raytrace::line_sphere_intersect(const torch::Tensor &line_start,
     return mask;
 }
 
+// Two-tier variant of line_sphere_intersect producing exactly the same mask [M,N]
+// Temporaries live in a workspace local to the call, see line_sphere_intersect_mixed_out
+Tensor raytrace::line_sphere_intersect_mixed(const torch::Tensor &line_start,
+                                             const torch::Tensor &line_end,
+                                             const torch::Tensor &block_cells,
+                                             const torch::Tensor &block_radius) {
+    raytrace_workspace ws;
+    Tensor mask;
+    line_sphere_intersect_mixed_out(line_start, line_end, block_cells, block_radius, ws, mask);
+    return mask;
+}
+
 // Function to perform batch processing of line-sphere intersection
 // HIGHLIGHT:   Batch processing avoids memory overflow;
 //              Adaptive pruning improves computational efficiency;
@@ -110,7 +138,6 @@ void raytrace::line_sphere_intersect_batch(const int64_t batch_size,
         }
 
         hits = hits + mask_intersect.sum(0); // [N]
-        std::cout << "hits.shape:" << hits.sizes() << std::endl;
 
         prune_count += 1;
         if (prune_count > prune_period && end < num_block_cells) {
@@ -138,7 +165,10 @@ void raytrace::line_sphere_intersect_batch(const int64_t batch_size,
 // - Dynamically computes minimal max_col to reduce hash range and sorting cost.
 // WRowIdx [N]
 // WColIdx [N]
-inline void dedup_and_sort(torch::Tensor &WRowIdx, torch::Tensor &WColIdx) {
+void raytrace::dedup_and_sort(torch::Tensor &WRowIdx, torch::Tensor &WColIdx) {
+    memory_scope scope("dedup");
+    if (WColIdx.numel() == 0)
+        return; // max() is undefined on empty tensors
     // here we use a valid max_col which is as small as possible to reduce overhead in torch::_unique radix/bucket sort
     // unnecessary to use power of 2 as compiler is smart enough
     int64_t max_col = WColIdx.max().item<int64_t>() + 1;
@@ -150,10 +180,546 @@ inline void dedup_and_sort(torch::Tensor &WRowIdx, torch::Tensor &WColIdx) {
     WColIdx = unique_hash % max_col;
 }
 
+Tensor &raytrace_workspace::reserve(Tensor &buf, IntArrayRef sizes, const TensorOptions &options) {
+    if (!buf.defined() || buf.scalar_type() != options.dtype().toScalarType() || buf.device() != options.device()) {
+        buf = torch::empty(sizes, options);
+    } else {
+        buf.resize_(sizes); // keeps the storage when it is already large enough
+    }
+    return buf;
+}
+
+// [num_cells] view of a radius tensor filled with value, refilled only when it grows or value changes
+Tensor raytrace_workspace::radius_for(int64_t num_cells, float value, const TensorOptions &options) {
+    int64_t filled = radius.defined() ? radius.size(0) : 0;
+    if (!radius.defined() || num_cells > filled || value != radius_value || radius.device() != options.device()) {
+        reserve(radius, {std::max(num_cells, filled)}, options.dtype(torch::kFloat)).fill_(value);
+        radius_value = value;
+    }
+    return radius.narrow(0, 0, num_cells);
+}
+
+// Same as filter_rays, results written to res_pos [M,3] and res_idx [M]
+void raytrace::filter_rays_out(const float con_rad,
+                               const torch::Tensor &target_pos,
+                               const torch::Tensor &input_pos,
+                               const torch::Tensor &input_idx,
+                               raytrace_workspace &ws,
+                               torch::Tensor &res_pos,
+                               torch::Tensor &res_idx) {
+    memory_scope scope("filter");
+    int64_t N = input_pos.size(0);
+    Tensor &diff = raytrace_workspace::reserve(ws.filter_diff, input_pos.sizes(), input_pos.options());
+    torch::sub_out(diff, input_pos, target_pos);
+    diff.mul_(diff);
+    Tensor &dist_squared = raytrace_workspace::reserve(ws.filter_dist, {N}, input_pos.options());
+    torch::sum_out(dist_squared, diff, {1});
+    Tensor &mask = raytrace_workspace::reserve(ws.filter_mask, {N}, input_pos.options().dtype(torch::kBool));
+    torch::lt_out(mask, dist_squared, con_rad * con_rad);
+    Tensor &nz = raytrace_workspace::reserve(ws.filter_nz, {0, 1}, input_idx.options().dtype(torch::kLong));
+    torch::nonzero_out(nz, mask); // [M,1]
+    raytrace_workspace::reserve(res_pos, {0, 3}, input_pos.options());
+    raytrace_workspace::reserve(res_idx, {0}, input_idx.options());
+    torch::index_select_out(res_pos, input_pos, 0, nz.select(1, 0));
+    torch::index_select_out(res_idx, input_idx, 0, nz.select(1, 0));
+}
+
+// Same as rays_from_neuronsA_to_neuronsB, the [N,M,3] diffs live in the workspace
+void raytrace::rays_from_neuronsA_to_neuronsB_out(const float con_rad,
+                                                  const torch::Tensor &pos_A,
+                                                  const torch::Tensor &pos_B,
+                                                  const torch::Tensor &idx_A,
+                                                  const torch::Tensor &idx_B,
+                                                  raytrace_workspace &ws,
+                                                  torch::Tensor &tiled_pos_A,
+                                                  torch::Tensor &tiled_pos_B,
+                                                  torch::Tensor &tiled_idx_A,
+                                                  torch::Tensor &tiled_idx_B) {
+    memory_scope scope("pair_generation");
+    int64_t N = pos_A.size(0);
+    int64_t M = pos_B.size(0);
+
+    Tensor &diff = raytrace_workspace::reserve(ws.pair_diff, {N, M, 3}, pos_A.options());
+    torch::sub_out(diff, pos_A.unsqueeze(1), pos_B.unsqueeze(0)); // [N,M,3]
+    diff.mul_(diff);
+    Tensor &dist_squared = raytrace_workspace::reserve(ws.pair_dist, {N, M}, pos_A.options());
+    torch::sum_out(dist_squared, diff, {2}); // [N,M]
+    Tensor &mask = raytrace_workspace::reserve(ws.pair_mask, {N, M}, pos_A.options().dtype(torch::kBool));
+    torch::lt_out(mask, dist_squared, con_rad * con_rad);
+    Tensor &idx_pairs = raytrace_workspace::reserve(ws.pair_nz, {0, 2}, idx_A.options().dtype(torch::kLong));
+    torch::nonzero_out(idx_pairs, mask); // [K,2]
+
+    raytrace_workspace::reserve(tiled_pos_A, {0, 3}, pos_A.options());
+    raytrace_workspace::reserve(tiled_pos_B, {0, 3}, pos_B.options());
+    raytrace_workspace::reserve(tiled_idx_A, {0}, idx_A.options());
+    raytrace_workspace::reserve(tiled_idx_B, {0}, idx_B.options());
+    torch::index_select_out(tiled_pos_A, pos_A, 0, idx_pairs.select(1, 0));
+    torch::index_select_out(tiled_pos_B, pos_B, 0, idx_pairs.select(1, 1));
+    torch::index_select_out(tiled_idx_A, idx_A, 0, idx_pairs.select(1, 0));
+    torch::index_select_out(tiled_idx_B, idx_B, 0, idx_pairs.select(1, 1));
+}
+
+// Same as line_sphere_intersect, a single [M,N,3] workspace buffer holds every intermediate in turn
+// The arithmetic is performed in the same order, so the mask is bit-identical
+void raytrace::line_sphere_intersect_out(const torch::Tensor &line_start,
+                                         const torch::Tensor &line_end,
+                                         const torch::Tensor &block_cells,
+                                         const torch::Tensor &block_radius,
+                                         raytrace_workspace &ws,
+                                         torch::Tensor &mask) {
+    int64_t N = line_start.size(0);
+    int64_t M = block_cells.size(0);
+    auto opts = line_start.options();
+
+    Tensor &line_dir = raytrace_workspace::reserve(ws.line_dir, {N, 3}, opts);
+    torch::sub_out(line_dir, line_end, line_start); // [N,3]
+    Tensor &line_dir_prod = raytrace_workspace::reserve(ws.line_dir_prod, {N, 3}, opts);
+    torch::mul_out(line_dir_prod, line_dir, line_dir);
+    Tensor &line_dir_sq = raytrace_workspace::reserve(ws.line_dir_sq, {N}, opts);
+    torch::sum_out(line_dir_sq, line_dir_prod, {1}); // [N]
+
+    Tensor &work = raytrace_workspace::reserve(ws.block_diff, {M, N, 3}, opts);
+    torch::sub_out(work, block_cells.unsqueeze(1), line_start.unsqueeze(0)); // line_start_to_block [M,N,3]
+    work.mul_(line_dir.unsqueeze(0));
+    Tensor &ratio = raytrace_workspace::reserve(ws.block_dot, {M, N}, opts);
+    torch::sum_out(ratio, work, {2}); // dot_product [M,N]
+    ratio.div_(line_dir_sq.unsqueeze(0));
+    ratio.clamp_(0, 1); // projection_ratio
+
+    torch::mul_out(work, ratio.unsqueeze(2), line_dir.unsqueeze(0));
+    work.add_(line_start.unsqueeze(0)); // closest_point
+    work.sub_(block_cells.unsqueeze(1)); // block_to_closest
+    work.mul_(work);
+    Tensor &dist_squared = ratio; // projection_ratio is no longer needed
+    torch::sum_out(dist_squared, work, {2});
+
+    Tensor &radius_sq = raytrace_workspace::reserve(ws.block_radius_sq, {M}, block_radius.options());
+    torch::mul_out(radius_sq, block_radius, block_radius);
+    raytrace_workspace::reserve(mask, {M, N}, opts.dtype(torch::kBool));
+    torch::le_out(mask, dist_squared, radius_sq.unsqueeze(1)); // [M,N]
+}
+
+// Two-tier variant of line_sphere_intersect_out producing exactly the same mask [M,N]
+// First pass: coordinates are moved into the frame of the ray bundle (centre at the origin, half extent 1)
+// and the projection test runs in float16 over all M*N pairs, with the op sequence of line_sphere_intersect_out
+// in a single [M,N,3] float16 workspace buffer. A pair is decided there only when its distance is further than
+// LOWP_MARGIN_FACTOR * (bound + 1) from the sphere radius, which exceeds the accumulated float16 rounding of
+// the few operations involved with a wide safety margin.
+// Second pass: the remaining borderline pairs (and degenerate/very short rays) are re-tested with the
+// float32 formula of line_sphere_intersect evaluated element by element, so their result is bit-identical.
+// Occluders far outside the bundle are clamped to +-bound, which keeps float16 in range and leaves them misses.
+void raytrace::line_sphere_intersect_mixed_out(const torch::Tensor &line_start,
+                                               const torch::Tensor &line_end,
+                                               const torch::Tensor &block_cells,
+                                               const torch::Tensor &block_radius,
+                                               raytrace_workspace &ws,
+                                               torch::Tensor &mask) {
+    int64_t N = line_start.size(0);
+    int64_t M = block_cells.size(0);
+    if (N == 0 || M == 0)
+        return line_sphere_intersect_out(line_start, line_end, block_cells, block_radius, ws, mask);
+    auto opts = line_start.options();
+    auto half_opts = opts.dtype(torch::kHalf);
+
+    // bundle frame: rows are start min, start max, end min, end max; rows 0 and 1 end up as the bundle min and max
+    Tensor &bounds = raytrace_workspace::reserve(ws.lp_bounds, {4, 3}, opts);
+    Tensor lo = bounds.select(0, 0);
+    Tensor hi = bounds.select(0, 1);
+    Tensor end_lo = bounds.select(0, 2);
+    Tensor end_hi = bounds.select(0, 3);
+    torch::amin_out(lo, line_start, {0});
+    torch::amax_out(hi, line_start, {0});
+    torch::amin_out(end_lo, line_end, {0});
+    torch::amax_out(end_hi, line_end, {0});
+    torch::minimum_out(lo, lo, end_lo);
+    torch::maximum_out(hi, hi, end_hi);
+    Tensor &origin = raytrace_workspace::reserve(ws.lp_origin, {3}, opts);
+    torch::add_out(origin, lo, hi).mul_(0.5f);
+    Tensor &radius_max = raytrace_workspace::reserve(ws.lp_radius_max, {}, block_radius.options());
+    torch::amax_out(radius_max, block_radius, {0});
+    Tensor &bounds_cpu = raytrace_workspace::reserve(ws.lp_bounds_cpu, {4, 3}, torch::TensorOptions().dtype(torch::kFloat));
+    bounds_cpu.copy_(bounds);
+    const float *b = bounds_cpu.data_ptr<float>();
+    float scale = 0.0f;
+    for (int d = 0; d < 3; ++d)
+        scale = std::max(scale, (b[3 + d] - b[d]) * 0.5f);
+    if (!(scale > 0.0f))
+        return line_sphere_intersect_out(line_start, line_end, block_cells, block_radius, ws, mask);
+
+    // clamped occluders stay at least bound-1 away from the bundle, beyond radius + margin
+    float bound = std::max(LOWP_MIN_BOUND, 2.0f * (radius_max.item<float>() / scale + 1.0f));
+    if (bound > LOWP_MAX_BOUND) // radius too large for the bundle, float16 would overflow
+        return line_sphere_intersect_out(line_start, line_end, block_cells, block_radius, ws, mask);
+    float margin = LOWP_MARGIN_FACTOR * (bound + 1.0f);
+
+    // rays and occluders in the bundle frame, shifted in float32 before the float16 conversion
+    Tensor &scaled = raytrace_workspace::reserve(ws.lp_scaled, {N, 3}, opts);
+    Tensor &s = raytrace_workspace::reserve(ws.lp_start, {N, 3}, half_opts);
+    torch::sub_out(scaled, line_start, origin.unsqueeze(0));
+    s.copy_(scaled.div_(scale));
+    Tensor &line_dir = raytrace_workspace::reserve(ws.lp_dir, {N, 3}, half_opts);
+    torch::sub_out(scaled, line_end, origin.unsqueeze(0));
+    line_dir.copy_(scaled.div_(scale));
+    line_dir.sub_(s); // e - s
+    Tensor &line_dir_prod = raytrace_workspace::reserve(ws.lp_dir_prod, {N, 3}, half_opts);
+    torch::mul_out(line_dir_prod, line_dir, line_dir);
+    Tensor &line_dir_sq = raytrace_workspace::reserve(ws.lp_dir_sq, {N}, half_opts);
+    torch::sum_out(line_dir_sq, line_dir_prod, {1}); // [N]
+    Tensor &cells_scaled = raytrace_workspace::reserve(ws.lp_cells_scaled, {M, 3}, opts);
+    torch::sub_out(cells_scaled, block_cells, origin.unsqueeze(0));
+    cells_scaled.div_(scale).clamp_(-bound, bound);
+    Tensor &c = raytrace_workspace::reserve(ws.lp_cells, {M, 3}, half_opts);
+    c.copy_(cells_scaled);
+
+    Tensor &work = raytrace_workspace::reserve(ws.lp_work, {M, N, 3}, half_opts);
+    torch::sub_out(work, c.unsqueeze(1), s.unsqueeze(0)); // line_start_to_block [M,N,3]
+    work.mul_(line_dir.unsqueeze(0));
+    Tensor &ratio = raytrace_workspace::reserve(ws.lp_ratio, {M, N}, half_opts);
+    torch::sum_out(ratio, work, {2}); // dot_product [M,N]
+    ratio.div_(line_dir_sq.unsqueeze(0));
+    ratio.clamp_(0, 1); // projection_ratio
+
+    torch::mul_out(work, ratio.unsqueeze(2), line_dir.unsqueeze(0));
+    work.add_(s.unsqueeze(0));  // closest_point
+    work.sub_(c.unsqueeze(1)); // block_to_closest
+    work.mul_(work);
+    Tensor &dist = raytrace_workspace::reserve(ws.lp_dist, {M, N}, opts);
+    torch::sum_out(dist, work, {2}, false, torch::kFloat);
+    dist.sqrt_(); // [M,N]
+
+    // radius - margin and radius + margin in the bundle frame [2,M]
+    Tensor &radius = raytrace_workspace::reserve(ws.lp_radius, {2, M}, block_radius.options());
+    Tensor radius_lo = radius.select(0, 0);
+    Tensor radius_hi = radius.select(0, 1);
+    torch::div_out(radius_lo, block_radius, scale);
+    radius_hi.copy_(radius_lo).add_(margin);
+    radius_lo.sub_(margin);
+
+    raytrace_workspace::reserve(mask, {M, N}, opts.dtype(torch::kBool));
+    torch::lt_out(mask, dist, radius_lo.unsqueeze(1)); // hit
+    Tensor &borderline = raytrace_workspace::reserve(ws.lp_borderline, {M, N}, opts.dtype(torch::kBool));
+    torch::gt_out(borderline, dist, radius_hi.unsqueeze(1)); // miss
+    borderline.logical_or_(mask).logical_not_();            // neither, includes NaN from zero-length rays
+    Tensor &short_ray = raytrace_workspace::reserve(ws.lp_short, {N}, opts.dtype(torch::kBool));
+    torch::lt_out(short_ray, line_dir_sq, LOWP_MIN_LEN_SQ);
+    borderline.logical_or_(short_ray.unsqueeze(0));
+
+    Tensor &pairs = raytrace_workspace::reserve(ws.lp_pairs, {0, 2}, opts.dtype(torch::kLong));
+    torch::nonzero_out(pairs, borderline); // [K,2]
+    int64_t K = pairs.size(0);
+    if (K == 0)
+        return;
+    Tensor m = pairs.select(1, 0);
+    Tensor n = pairs.select(1, 1);
+
+    // same float32 operations as line_sphere_intersect, one pair per row
+    Tensor &full_dir = raytrace_workspace::reserve(ws.line_dir, {N, 3}, opts);
+    torch::sub_out(full_dir, line_end, line_start);
+    Tensor &full_dir_prod = raytrace_workspace::reserve(ws.line_dir_prod, {N, 3}, opts);
+    torch::mul_out(full_dir_prod, full_dir, full_dir);
+    Tensor &full_dir_sq = raytrace_workspace::reserve(ws.line_dir_sq, {N}, opts);
+    torch::sum_out(full_dir_sq, full_dir_prod, {1});
+
+    Tensor &sel_start = raytrace_workspace::reserve(ws.lp_sel_start, {K, 3}, opts);
+    Tensor &sel_dir = raytrace_workspace::reserve(ws.lp_sel_dir, {K, 3}, opts);
+    Tensor &sel_block = raytrace_workspace::reserve(ws.lp_sel_block, {K, 3}, opts);
+    torch::index_select_out(sel_start, line_start, 0, n);
+    torch::index_select_out(sel_dir, full_dir, 0, n);
+    torch::index_select_out(sel_block, block_cells, 0, m);
+    Tensor &pair_work = raytrace_workspace::reserve(ws.lp_pair_work, {K, 3}, opts);
+    torch::sub_out(pair_work, sel_block, sel_start);
+    pair_work.mul_(sel_dir);
+    Tensor &pair_ratio = raytrace_workspace::reserve(ws.lp_pair_ratio, {K}, opts);
+    torch::sum_out(pair_ratio, pair_work, {1}); // pair_dot
+    Tensor &pair_scalar = raytrace_workspace::reserve(ws.lp_pair_scalar, {K}, opts);
+    torch::index_select_out(pair_scalar, full_dir_sq, 0, n);
+    pair_ratio.div_(pair_scalar);
+    pair_ratio.clamp_(0, 1);
+    torch::mul_out(pair_work, pair_ratio.unsqueeze(1), sel_dir);
+    pair_work.add_(sel_start);  // pair_closest
+    pair_work.sub_(sel_block); // pair_diff
+    pair_work.mul_(pair_work);
+    Tensor &pair_dist_sq = pair_ratio; // pair_ratio is no longer needed
+    torch::sum_out(pair_dist_sq, pair_work, {1});
+
+    Tensor &radius_sq = raytrace_workspace::reserve(ws.block_radius_sq, {M}, block_radius.options());
+    torch::mul_out(radius_sq, block_radius, block_radius);
+    torch::index_select_out(pair_scalar, radius_sq, 0, m);
+    Tensor &exact = raytrace_workspace::reserve(ws.lp_exact, {K}, opts.dtype(torch::kBool));
+    torch::le_out(exact, pair_dist_sq, pair_scalar);
+    mask.index_put_({m, n}, exact);
+}
+
+// keep the rows of t selected by keep_idx; scratch holds the gathered rows before they are copied back
+static void compact_rows_(Tensor &t, const Tensor &keep_idx, Tensor &scratch) {
+    raytrace_workspace::reserve(scratch, {0}, t.options());
+    torch::index_select_out(scratch, t, 0, keep_idx);
+    t.resize_(scratch.sizes());
+    t.copy_(scratch);
+}
+
+static void prune_rays_(raytrace_workspace &ws,
+                        int64_t max_allowed_hits,
+                        bool with_hits,
+                        Tensor &line_start,
+                        Tensor &line_end,
+                        Tensor &index_start,
+                        Tensor &index_end) {
+    Tensor &valid_hits = raytrace_workspace::reserve(ws.keep_mask, {ws.hits.size(0)}, ws.hits.options().dtype(torch::kBool));
+    torch::le_out(valid_hits, ws.hits, max_allowed_hits);
+    Tensor &keep = raytrace_workspace::reserve(ws.keep_idx, {0, 1}, ws.hits.options());
+    torch::nonzero_out(keep, valid_hits);
+    Tensor keep_idx = keep.select(1, 0);
+    compact_rows_(line_start, keep_idx, ws.compact_pos);
+    compact_rows_(line_end, keep_idx, ws.compact_pos);
+    compact_rows_(index_start, keep_idx, ws.compact_idx);
+    compact_rows_(index_end, keep_idx, ws.compact_idx);
+    if (with_hits)
+        compact_rows_(ws.hits, keep_idx, ws.compact_idx);
+}
+
+// Same as line_sphere_intersect_batch, the rays are compacted in place inside their own buffers
+void raytrace::line_sphere_intersect_batch_out(const int64_t batch_size,
+                                               const int64_t max_allowed_hits,
+                                               const torch::Tensor &block_cells,
+                                               const torch::Tensor &block_radius,
+                                               raytrace_workspace &ws,
+                                               torch::Tensor &line_start,
+                                               torch::Tensor &line_end,
+                                               torch::Tensor &index_start,
+                                               torch::Tensor &index_end,
+                                               const bool low_precision) {
+    int64_t num_block_cells = block_cells.size(0);
+    // CPU float16 kernels convert element by element and are slower than float32, so only CUDA takes the mixed path
+    bool mixed = low_precision && line_start.is_cuda();
+    size_t prune_period = -1;
+    size_t prune_count = 0;
+    Tensor &hits = raytrace_workspace::reserve(ws.hits, {index_start.size(0)}, index_start.options().dtype(torch::kLong));
+    hits.zero_();
+    for (int64_t i = 0; i < num_block_cells; i += batch_size) {
+        int64_t end = std::min(i + batch_size, num_block_cells);
+        Tensor batch_cells = block_cells.slice(0, i, end);
+        Tensor batch_radius = block_radius.slice(0, i, end);
+        if (mixed)
+            line_sphere_intersect_mixed_out(line_start, line_end, batch_cells, batch_radius, ws, ws.mask); // [M',N]
+        else
+            line_sphere_intersect_out(line_start, line_end, batch_cells, batch_radius, ws, ws.mask); // [M',N]
+
+        if (prune_period == -1) {
+            prune_period = ws.mask.numel() > 0 ? PRUNE_COUNT_LIMIT / ws.mask.numel() : PRUNE_COUNT_LIMIT;
+        }
+
+        // a bool -> long reduction would cast the whole mask into a fresh tensor, so the cast goes through the workspace
+        Tensor &mask_count = raytrace_workspace::reserve(ws.mask_count, ws.mask.sizes(), hits.options());
+        mask_count.copy_(ws.mask);
+        Tensor &hits_delta = raytrace_workspace::reserve(ws.hits_delta, {hits.size(0)}, hits.options());
+        torch::sum_out(hits_delta, mask_count, {0}); // [N]
+        hits.add_(hits_delta);
+
+        prune_count += 1;
+        if (prune_count > prune_period && end < num_block_cells) {
+            prune_rays_(ws, max_allowed_hits, true, line_start, line_end, index_start, index_end);
+            prune_count = 0;
+            prune_period = -1; // reset prune period
+        }
+    }
+    prune_rays_(ws, max_allowed_hits, false, line_start, line_end, index_start, index_end);
+}
+
+// Same as dedup_and_sort, reading from in_* and writing the unique sorted pairs to WRowIdx/WColIdx
+// torch::_unique has no out= form, so duplicates are dropped with sort_out and a neighbour comparison
+void raytrace::dedup_and_sort_out(const torch::Tensor &in_WRowIdx,
+                                  const torch::Tensor &in_WColIdx,
+                                  raytrace_workspace &ws,
+                                  torch::Tensor &WRowIdx,
+                                  torch::Tensor &WColIdx) {
+    memory_scope scope("dedup");
+    int64_t n = in_WColIdx.size(0);
+    auto opts = in_WColIdx.options();
+    raytrace_workspace::reserve(WRowIdx, {0}, opts);
+    raytrace_workspace::reserve(WColIdx, {0}, opts);
+    if (n == 0)
+        return;
+
+    torch::amax_out(raytrace_workspace::reserve(ws.max_col, {}, opts), in_WColIdx, {0});
+    int64_t max_col = ws.max_col.item<int64_t>() + 1;
+    Tensor &hash = raytrace_workspace::reserve(ws.hash, {n}, opts);
+    hash.copy_(in_WRowIdx).mul_(max_col).add_(in_WColIdx);
+
+    Tensor &sorted_hash = raytrace_workspace::reserve(ws.sorted_hash, {n}, opts);
+    Tensor &sort_perm = raytrace_workspace::reserve(ws.sort_perm, {n}, opts);
+    torch::sort_out(sorted_hash, sort_perm, hash);
+
+    Tensor &unique_mask = raytrace_workspace::reserve(ws.unique_mask, {n}, opts.dtype(torch::kBool));
+    unique_mask.narrow(0, 0, 1).fill_(true);
+    Tensor unique_tail = unique_mask.narrow(0, 1, n - 1);
+    torch::ne_out(unique_tail, sorted_hash.narrow(0, 1, n - 1), sorted_hash.narrow(0, 0, n - 1));
+    torch::masked_select_out(hash, sorted_hash, unique_mask); // hash now holds the unique sorted keys
+
+    raytrace_workspace::reserve(WColIdx, {hash.size(0)}, opts).copy_(hash).remainder_(max_col);
+    raytrace_workspace::reserve(WRowIdx, {hash.size(0)}, opts).copy_(hash).div_(max_col, "floor");
+}
+
 // Function to perform ray tracing with distance limitation in batch
 // This function traces rays from sender neurons to hidden neurons, applying distance limits
+// Temporaries live in a workspace local to the call, pass a raytrace_workspace to reuse them across calls
 std::tuple<torch::Tensor, torch::Tensor>
 raytrace::raytrace_distance_limited(const modeldata &model_info,
+                                    const torch::Tensor &glia_pos,
+                                    const torch::Tensor &sender_pos,
+                                    const torch::Tensor &hidden_pos,
+                                    const std::optional<torch::Tensor> &prev_WRowIdx,
+                                    const std::optional<torch::Tensor> &prev_WColIdx) {
+    raytrace_workspace ws;
+    return raytrace_distance_limited(ws, model_info, glia_pos, sender_pos, hidden_pos, prev_WRowIdx, prev_WColIdx);
+}
+
+// Function to bound the ray bundle held in ws.sender_* / ws.hidden_* for occluder culling
+// Every ray runs between a point of ws.sender_pos and one of ws.hidden_pos, so it stays inside their bounding box,
+// and an occluder of radius neuron_rad can only touch it when its centre is within neuron_rad of that box.
+// Output the box expanded by neuron_rad as host coordinates lo, hi; the bounds go through workspace buffers
+static void bundle_box(raytrace_workspace &ws, float neuron_rad, std::array<float, 3> &lo, std::array<float, 3> &hi) {
+    Tensor &bounds = raytrace_workspace::reserve(ws.cull_bounds, {4, 3}, ws.sender_pos.options()); // sender min/max, hidden min/max
+    Tensor sender_lo = bounds.select(0, 0);
+    Tensor sender_hi = bounds.select(0, 1);
+    Tensor hidden_lo = bounds.select(0, 2);
+    Tensor hidden_hi = bounds.select(0, 3);
+    torch::amin_out(sender_lo, ws.sender_pos, {0});
+    torch::amax_out(sender_hi, ws.sender_pos, {0});
+    torch::amin_out(hidden_lo, ws.hidden_pos, {0});
+    torch::amax_out(hidden_hi, ws.hidden_pos, {0});
+    Tensor &bounds_cpu = raytrace_workspace::reserve(ws.cull_bounds_cpu, {4, 3}, torch::TensorOptions().dtype(torch::kFloat));
+    bounds_cpu.copy_(bounds);
+    const float *b = bounds_cpu.data_ptr<float>();
+    float reach = COVERAGE_REACH_SLACK * neuron_rad;
+    for (int d = 0; d < 3; ++d) {
+        lo[d] = std::min(b[d], b[6 + d]) - reach;
+        hi[d] = std::max(b[3 + d], b[9 + d]) + reach;
+    }
+}
+
+// Function to cull occluder_pos [M,3] to the grid cells overlapping the box [lo, hi], grid is built over occluder_pos
+// Output res_pos [K,3], a superset of the occluders inside the box
+static void cull_occluders_out(const spatial_grid &grid,
+                               const torch::Tensor &occluder_pos,
+                               const std::array<float, 3> &lo,
+                               const std::array<float, 3> &hi,
+                               raytrace_workspace &ws,
+                               torch::Tensor &res_pos) {
+    memory_scope scope("occluder_cull");
+    grid.query_box_out(lo, hi, ws.cull_found, ws.cull_idx);
+    raytrace_workspace::reserve(res_pos, {0, 3}, occluder_pos.options());
+    torch::index_select_out(res_pos, occluder_pos, 0, ws.cull_idx);
+}
+
+// append the rows of values to the grow-only buffer buf [n] -> [n+k]
+// storage grows geometrically, so a run of appends copies every element only a bounded number of times
+static void append_rows_(Tensor &buf, const Tensor &values) {
+    int64_t n = buf.size(0);
+    int64_t k = values.size(0);
+    if (static_cast<size_t>((n + k) * buf.element_size()) > buf.storage().nbytes())
+        buf.resize_({std::max(n + k, 2 * n)}); // resize_ keeps the first n rows
+    buf.resize_({n + k});
+    buf.narrow(0, n, k).copy_(values);
+}
+
+// sort and deduplicate the edges accumulated in ws.WRowIdx / ws.WColIdx, passing through the cat buffers
+static void sort_accumulated_(raytrace_workspace &ws) {
+    std::swap(ws.WRowIdx, ws.cat_row);
+    std::swap(ws.WColIdx, ws.cat_col);
+    raytrace::dedup_and_sort_out(ws.cat_row, ws.cat_col, ws, ws.WRowIdx, ws.WColIdx);
+}
+
+// Trace the rays between the senders and hidden neurons currently held in ws.sender_* / ws.hidden_*
+// and append the unoccluded ones to ws.WRowIdx / ws.WColIdx, unsorted; see sort_accumulated_
+// Pairs already in memo are dropped before the occlusion tests
+// Returns false when the bundle has no rays or all of them are occluded; a bundle whose rays were all traced
+// by earlier rounds returns true, as it only found known edges
+static bool trace_bundle(raytrace_workspace &ws,
+                         const modeldata &model_info,
+                         const torch::Tensor &glia_pos,
+                         const torch::Tensor &hidden_pos,
+                         pair_memo *memo = nullptr) {
+    float con_rad = model_info.con_rad;
+    // here ray_start, ray_end are the start and end of rays, one to one correspondence
+    raytrace::rays_from_neuronsA_to_neuronsB_out(con_rad,
+                                                 ws.sender_pos,
+                                                 ws.hidden_pos,
+                                                 ws.sender_idx,
+                                                 ws.hidden_idx,
+                                                 ws,
+                                                 ws.ray_start,
+                                                 ws.ray_end,
+                                                 ws.ray_start_idx,
+                                                 ws.ray_end_idx);
+    if (ws.ray_start_idx.size(0) == 0) {
+        return false; // no rays found
+    }
+
+    if (memo != nullptr) {
+        memory_scope scope("pair_memo");
+        Tensor seen = memo->test_and_set(ws.ray_end_idx, ws.ray_start_idx);
+        Tensor &fresh = raytrace_workspace::reserve(ws.keep_mask, {seen.size(0)}, seen.options());
+        torch::logical_not_out(fresh, seen);
+        Tensor &keep = raytrace_workspace::reserve(ws.keep_idx, {0, 1}, ws.ray_start_idx.options());
+        torch::nonzero_out(keep, fresh);
+        Tensor keep_idx = keep.select(1, 0);
+        compact_rows_(ws.ray_start, keep_idx, ws.compact_pos);
+        compact_rows_(ws.ray_end, keep_idx, ws.compact_pos);
+        compact_rows_(ws.ray_start_idx, keep_idx, ws.compact_idx);
+        compact_rows_(ws.ray_end_idx, keep_idx, ws.compact_idx);
+        if (ws.ray_start_idx.size(0) == 0) {
+            return true; // every ray was traced by an earlier round
+        }
+    }
+
+    if (model_info.ray_neuron_intersect) {
+        int64_t raytrace_batch_size = 1 + RAYTRACE_LIMIT / ws.ray_start.size(0);
+        Tensor hidden_radius = ws.radius_for(hidden_pos.size(0), model_info.neuron_rad, hidden_pos.options());
+        memory_scope scope("neuron_occlusion");
+        raytrace::line_sphere_intersect_batch_out(raytrace_batch_size,
+                                                  MAX_ALLOWED_HITS_NEURON,
+                                                  hidden_pos,
+                                                  hidden_radius,
+                                                  ws,
+                                                  ws.ray_start,
+                                                  ws.ray_end,
+                                                  ws.ray_start_idx,
+                                                  ws.ray_end_idx,
+                                                  model_info.ray_low_precision);
+    }
+    if (ws.ray_start_idx.size(0) == 0) {
+        return false; // no rays found after intersection
+    }
+
+    // glial cells intersection, glia radius should be the same as neuron radius
+    Tensor glia_radius = ws.radius_for(glia_pos.size(0), model_info.neuron_rad, glia_pos.options());
+    int64_t raytrace_batch_size = 1 + RAYTRACE_LIMIT / ws.ray_start.size(0);
+    {
+        memory_scope scope("glia_occlusion");
+        raytrace::line_sphere_intersect_batch_out(raytrace_batch_size,
+                                                  MAX_ALLOWED_HITS_GLIA,
+                                                  glia_pos,
+                                                  glia_radius,
+                                                  ws,
+                                                  ws.ray_start,
+                                                  ws.ray_end,
+                                                  ws.ray_start_idx,
+                                                  ws.ray_end_idx,
+                                                  model_info.ray_low_precision);
+    }
+    if (ws.ray_start_idx.size(0) == 0) {
+        return false; // no rays found after glia intersection
+    }
+    // WColIdx is the sender neuron index, WRowIdx is the hidden neuron index
+    append_rows_(ws.WColIdx, ws.ray_start_idx);
+    append_rows_(ws.WRowIdx, ws.ray_end_idx);
+    return true;
+}
+
+std::tuple<torch::Tensor, torch::Tensor>
+raytrace::raytrace_distance_limited(raytrace_workspace &ws,
+                                    const modeldata &model_info,
                                     const torch::Tensor &glia_pos,
                                     const torch::Tensor &sender_pos, // the neuron sending rays, it can be hidden neuron itself[Na,3]
                                     const torch::Tensor &hidden_pos,
@@ -162,100 +728,523 @@ raytrace::raytrace_distance_limited(const modeldata &model_info,
 
     float con_rad = model_info.con_rad;
     size_t max_rounds = model_info.ray_max_rounds;
-    bool ray_neuron_intersect = model_info.ray_neuron_intersect;
+    auto idx_opts = torch::TensorOptions().dtype(torch::kLong).device(sender_pos.device());
 
-    Tensor sender_idx = torch::arange(sender_pos.size(0), torch::TensorOptions().dtype(torch::kLong).device(sender_pos.device())); // 1D
+    Tensor sender_idx = torch::arange(sender_pos.size(0), idx_opts);                                                              // 1D
     Tensor hidden_idx = torch::arange(hidden_pos.size(0), torch::TensorOptions().dtype(torch::kLong).device(hidden_pos.device())); // 1D
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, sender_pos.size(0) - 1);
-    Tensor WRowIdx = torch::empty({0}, torch::TensorOptions().dtype(torch::kLong).device(sender_pos.device()));
-    Tensor WColIdx = torch::empty({0}, torch::TensorOptions().dtype(torch::kLong).device(sender_pos.device()));
-
-    int64_t round_prev_con_num = 0;
-    size_t same_counter = 0;
-    for (size_t round = 0; round < max_rounds; ++round) {
-        int64_t random_index = dis(gen);
-        Tensor cur_batch_center = sender_pos.slice(0, random_index, random_index + 1); // [1,3]
-        auto [cur_sender_pos, cur_sender_idx] = filter_rays(2.0f * con_rad, cur_batch_center, sender_pos, sender_idx);
-        if (cur_sender_pos.size(0) == 0)
-            continue;
+    Tensor &WRowIdx = raytrace_workspace::reserve(ws.WRowIdx, {0}, idx_opts);
+    Tensor &WColIdx = raytrace_workspace::reserve(ws.WColIdx, {0}, idx_opts);
+    memo_stats = pair_memo_stats{};
 
-        auto [cur_hidden_pos, cur_hidden_idx] = filter_rays(con_rad, cur_batch_center, hidden_pos, hidden_idx);
-        if (cur_hidden_pos.size(0) == 0)
-            continue;
-        // now we have cur_sender_pos and cur_hidden_pos, cur_sender_idx and cur_hidden_idx, we can compute the rays
-        // here tiled_sender_pos, tiled_hidden_pos are the start and end of rays, one to one correspondence
-        auto [tiled_sender_pos, tiled_hidden_pos, tiled_sender_idx, tiled_hidden_idx] =
-            rays_from_neuronsA_to_neuronsB(con_rad, cur_sender_pos, cur_hidden_pos, cur_sender_idx, cur_hidden_idx);
-
-        // release memory
-        cur_sender_pos.reset();
-        cur_hidden_pos.reset();
-        cur_sender_idx.reset();
-        cur_hidden_idx.reset();
-        if (tiled_sender_idx.size(0) == 0 || tiled_hidden_idx.size(0) == 0) {
-            continue; // no rays found
+    // out-of-core mode: once the accumulated edges exceed ray_spill_bytes they are written out as a sorted run
+    // and accumulation restarts from empty buffers, so memory stays bounded by the threshold plus one round.
+    // It always runs the coverage schedule: the random schedule's stop criterion needs every edge found so far
+    // in memory to tell new edges from known ones, while coverage tiles trace each candidate ray exactly once.
+    bool coverage = model_info.ray_coverage_schedule || model_info.ray_spill_bytes > 0;
+    std::unique_ptr<edge_store> spill;
+    if (model_info.ray_spill_bytes > 0) {
+        int64_t num_cols = sender_pos.size(0);
+        if (prev_WColIdx.has_value() && prev_WColIdx.value().numel() > 0)
+            num_cols = std::max(num_cols, prev_WColIdx.value().max().item<int64_t>() + 1);
+        spill = std::make_unique<edge_store>(num_cols);
+    }
+    // the coverage schedule appends every tile unsorted, each candidate ray is traced exactly once so no edge
+    // repeats and one sort at the end (or before a spill, runs are sorted) replaces a full re-sort per tile
+    auto spill_if_full = [&]() {
+        if (!spill || 2 * WRowIdx.numel() * static_cast<int64_t>(sizeof(int64_t)) <= model_info.ray_spill_bytes)
+            return;
+        sort_accumulated_(ws);
+        spill->spill(WRowIdx, WColIdx);
+        WRowIdx.resize_({0});
+        WColIdx.resize_({0});
+    };
+
+    // Each round's rays lie in a small neighbourhood, so the occluders are bucketed once and every round only
+    // tests the ones near its bundle; per-round cost follows local density instead of the total cell count.
+    // Culling drops only occluders that cannot touch any ray of the bundle, so the edges are unchanged.
+    std::optional<spatial_grid> hidden_grid; // neurons only occlude with ray_neuron_intersect
+    if (model_info.ray_neuron_intersect)
+        hidden_grid.emplace(hidden_pos, con_rad);
+    spatial_grid glia_grid(glia_pos, con_rad);
+    auto trace_culled = [&](pair_memo *memo) -> bool {
+        std::array<float, 3> lo{}, hi{};
+        bundle_box(ws, model_info.neuron_rad, lo, hi);
+        if (hidden_grid)
+            cull_occluders_out(*hidden_grid, hidden_pos, lo, hi, ws, ws.occluder_pos);
+        else
+            raytrace_workspace::reserve(ws.occluder_pos, {0, 3}, hidden_pos.options());
+        cull_occluders_out(glia_grid, glia_pos, lo, hi, ws, ws.glia_occluder_pos);
+        return trace_bundle(ws, model_info, ws.glia_occluder_pos, ws.occluder_pos, memo);
+    };
+
+    if (coverage) {
+        // Tile the hidden neurons with cubes whose half diagonal is con_rad, each tile is one round.
+        // A sender within con_rad of a hidden neuron in the tile is within con_rad + half diagonal of the tile centre,
+        // so every candidate ray is traced exactly once and the loop ends when all tiles are covered.
+        float tile_size = 2.0f * con_rad / std::sqrt(3.0f);
+        float sender_reach = con_rad + COVERAGE_REACH_SLACK * con_rad;
+        spatial_grid tiles(hidden_pos, tile_size);
+        // the senders of a tile come from the cells within sender_reach, not a scan over every sender
+        std::optional<spatial_grid> own_sender_grid;
+        if (!sender_pos.is_same(hidden_pos))
+            own_sender_grid.emplace(sender_pos, tile_size);
+        const spatial_grid &sender_grid = own_sender_grid ? *own_sender_grid : tiles;
+
+        for (int64_t tile = 0; tile < tiles.num_cells(); ++tile) {
+            Tensor members = tiles.cell_members(tile);
+            raytrace_workspace::reserve(ws.hidden_idx, {members.size(0)}, members.options()).copy_(members);
+            raytrace_workspace::reserve(ws.hidden_pos, {0, 3}, hidden_pos.options());
+            torch::index_select_out(ws.hidden_pos, hidden_pos, 0, members);
+
+            std::array<float, 3> mid = tiles.cell_center_coords(tile);
+            std::array<float, 3> lo{}, hi{};
+            for (int d = 0; d < 3; ++d) {
+                lo[d] = mid[d] - sender_reach;
+                hi[d] = mid[d] + sender_reach;
+            }
+            sender_grid.query_box_out(lo, hi, ws.cull_found, ws.near_candidates);
+            raytrace_workspace::reserve(ws.near_candidate_pos, {0, 3}, sender_pos.options());
+            torch::index_select_out(ws.near_candidate_pos, sender_pos, 0, ws.near_candidates);
+            filter_rays_out(sender_reach, tiles.cell_center(tile), ws.near_candidate_pos, ws.near_candidates, ws, ws.sender_pos, ws.sender_idx);
+            if (ws.sender_pos.size(0) == 0)
+                continue;
+            trace_culled(nullptr);
+            spill_if_full();
+        }
+    } else {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_int_distribution<> dis(0, sender_pos.size(0) - 1);
+
+        // rays are decided by the full occluder sets, so a pair traced once never needs tracing again
+        std::unique_ptr<pair_memo> memo;
+        if (model_info.ray_pair_memo)
+            memo = std::make_unique<pair_memo>(hidden_pos.size(0), sender_pos.size(0), sender_pos.device());
+
+        int64_t round_prev_con_num = 0;
+        size_t same_counter = 0;
+        for (size_t round = 0; round < max_rounds; ++round) {
+            int64_t random_index = dis(gen);
+            Tensor cur_batch_center = sender_pos.slice(0, random_index, random_index + 1); // [1,3]
+            filter_rays_out(2.0f * con_rad, cur_batch_center, sender_pos, sender_idx, ws, ws.sender_pos, ws.sender_idx);
+            if (ws.sender_pos.size(0) == 0)
+                continue;
+
+            filter_rays_out(con_rad, cur_batch_center, hidden_pos, hidden_idx, ws, ws.hidden_pos, ws.hidden_idx);
+            if (ws.hidden_pos.size(0) == 0)
+                continue;
+            // now we have the senders and hidden neurons around the batch centre, we can compute the rays
+            // a round without unoccluded rays is skipped and does not count towards the stop criterion
+            if (!trace_culled(memo.get()))
+                continue;
+            sort_accumulated_(ws);
+
+            if (WRowIdx.size(0) > round_prev_con_num) {
+                round_prev_con_num = WRowIdx.size(0);
+                same_counter = 0;
+            } else
+                same_counter++;
+            if (same_counter > MAX_SAME_COUNTER) {
+                break;
+            } // if we have not found new connections for some (default 5) rounds, we can stop
+        }
+        if (memo)
+            memo_stats = memo->stats();
+    }
+    bool has_prev = prev_WRowIdx.has_value() && prev_WColIdx.has_value();
+    int64_t prev_edges = has_prev ? prev_WRowIdx.value().size(0) : 0;
+    if (spill && (spill->num_runs() > 0 || 2 * (WRowIdx.numel() + prev_edges) * static_cast<int64_t>(sizeof(int64_t)) >
+                                               model_info.ray_spill_bytes)) {
+        // the leftover edges and the previous edge list become further runs, prev in threshold-sized chunks,
+        // so nothing larger than the threshold is sorted in memory and the k-way merge removes the duplicates
+        sort_accumulated_(ws);
+        spill->spill(WRowIdx, WColIdx);
+        WRowIdx.resize_({0});
+        WColIdx.resize_({0});
+        if (has_prev) {
+            assert(prev_WColIdx.value().size(0) == prev_edges);
+            int64_t chunk = std::max<int64_t>(1, model_info.ray_spill_bytes / (2 * static_cast<int64_t>(sizeof(int64_t))));
+            for (int64_t start = 0; start < prev_edges; start += chunk) {
+                int64_t len = std::min(chunk, prev_edges - start);
+                dedup_and_sort_out(prev_WRowIdx.value().narrow(0, start, len).to(torch::kLong),
+                                   prev_WColIdx.value().narrow(0, start, len).to(torch::kLong),
+                                   ws,
+                                   ws.cat_row,
+                                   ws.cat_col);
+                spill->spill(ws.cat_row, ws.cat_col);
+            }
+        }
+        auto [merged_row, merged_col] = spill->merge(model_info.ray_spill_mmap);
+        return {merged_row.to(sender_pos.device()), merged_col.to(sender_pos.device())};
+    }
+    // deduplicate and sort the rays
+    if (has_prev) {
+        assert(prev_WColIdx.value().size(0) == prev_edges);
+
+        torch::cat_out(raytrace_workspace::reserve(ws.cat_row, {0}, idx_opts), {prev_WRowIdx.value(), WRowIdx}, 0);
+        torch::cat_out(raytrace_workspace::reserve(ws.cat_col, {0}, idx_opts), {prev_WColIdx.value(), WColIdx}, 0);
+        dedup_and_sort_out(ws.cat_row, ws.cat_col, ws, WRowIdx, WColIdx);
+    } else if (coverage) {
+        sort_accumulated_(ws);
+    }
+    // the workspace buffers are reused by the next call
+    return {WRowIdx.clone(), WColIdx.clone()};
+}
+
+// Function to find the entries of idx [K] that lie in [begin, end)
+// Output their positions [K'] in ascending order, a view of a workspace buffer valid until the next call
+static Tensor range_rows_(const Tensor &idx, int64_t begin, int64_t end, raytrace_workspace &ws) {
+    Tensor &in_range = raytrace_workspace::reserve(ws.range_mask, {idx.size(0)}, idx.options().dtype(torch::kBool));
+    Tensor &below_end = raytrace_workspace::reserve(ws.range_below, {idx.size(0)}, idx.options().dtype(torch::kBool));
+    torch::ge_out(in_range, idx, begin);
+    torch::lt_out(below_end, idx, end);
+    in_range.logical_and_(below_end);
+    Tensor &nz = raytrace_workspace::reserve(ws.range_nz, {0, 1}, idx.options().dtype(torch::kLong));
+    torch::nonzero_out(nz, in_range); // [K',1]
+    return nz.select(1, 0);
+}
+
+// Function to trace several connection classes over the same cells in one sweep
+// populations [P] of neuron positions [Ni,3]; each class traces populations[sender] -> populations[receiver]
+// with the receiver population as neuron occluders, exactly as a coverage-schedule raytrace_distance_limited
+// call per class would. All populations share one grid: every tile is queried once for nearby neurons of all
+// populations and once for glia, and each class only sees the occluders that can touch rays of that tile.
+// Output one (WRowIdx, WColIdx) per class, in population-local indices, sorted and deduplicated
+std::vector<std::tuple<torch::Tensor, torch::Tensor>> raytrace::raytrace_fused(const modeldata &model_info,
+                                                                               const torch::Tensor &glia_pos,
+                                                                               const std::vector<torch::Tensor> &populations,
+                                                                               const std::vector<connection_class> &classes) {
+    raytrace_workspace ws;
+    return raytrace_fused(ws, model_info, glia_pos, populations, classes);
+}
+
+std::vector<std::tuple<torch::Tensor, torch::Tensor>> raytrace::raytrace_fused(raytrace_workspace &ws,
+                                                                               const modeldata &model_info,
+                                                                               const torch::Tensor &glia_pos,
+                                                                               const std::vector<torch::Tensor> &populations,
+                                                                               const std::vector<connection_class> &classes) {
+    assert(!populations.empty());
+    float con_rad = model_info.con_rad;
+    auto pos_opts = populations[0].options();
+    auto idx_opts = torch::TensorOptions().dtype(torch::kLong).device(populations[0].device());
+
+    int64_t num_pop = static_cast<int64_t>(populations.size());
+    std::vector<int64_t> offset = {0};
+    for (const Tensor &pop : populations)
+        offset.push_back(offset.back() + pop.size(0));
+    Tensor all_pos = torch::cat(populations, 0);         // [N,3]
+    Tensor all_idx = torch::arange(offset.back(), idx_opts); // [N]
+
+    // same tiles as the coverage schedule; a ray of a tile lies within sender_reach of its centre,
+    // so only cells within sender_reach + neuron_rad can hold its senders or occluders
+    float tile_size = 2.0f * con_rad / std::sqrt(3.0f);
+    float sender_reach = con_rad + COVERAGE_REACH_SLACK * con_rad;
+    float occluder_reach = sender_reach + COVERAGE_REACH_SLACK * model_info.neuron_rad;
+    spatial_grid tiles(all_pos, tile_size);
+    spatial_grid glia_grid(glia_pos, tile_size);
+
+    std::vector<Tensor> rows(classes.size());
+    std::vector<Tensor> cols(classes.size());
+    for (size_t c = 0; c < classes.size(); ++c) {
+        assert(classes[c].sender >= 0 && classes[c].sender < num_pop);
+        assert(classes[c].receiver >= 0 && classes[c].receiver < num_pop);
+        rows[c] = torch::empty({0}, idx_opts);
+        cols[c] = torch::empty({0}, idx_opts);
+    }
+
+    ws.pop_near_pos.resize(num_pop);
+    ws.pop_near_idx.resize(num_pop);
+    ws.pop_members.resize(num_pop);
+    for (int64_t tile = 0; tile < tiles.num_cells(); ++tile) {
+        Tensor center = tiles.cell_center(tile);
+        std::array<float, 3> mid = tiles.cell_center_coords(tile);
+        std::array<float, 3> lo{}, hi{};
+        for (int d = 0; d < 3; ++d) {
+            lo[d] = mid[d] - occluder_reach;
+            hi[d] = mid[d] + occluder_reach;
         }
 
-        if (ray_neuron_intersect) {
-            int64_t raytrace_batch_size = 1 + RAYTRACE_LIMIT / tiled_sender_pos.size(0);
-            Tensor hidden_radius =
-                torch::full({hidden_pos.size(0)}, model_info.neuron_rad, torch::TensorOptions().dtype(torch::kFloat).device(hidden_pos.device()));
-
-            line_sphere_intersect_batch(raytrace_batch_size,
-                                        MAX_ALLOWED_HITS_NEURON,
-                                        hidden_pos,
-                                        hidden_radius,
-                                        tiled_sender_pos,
-                                        tiled_hidden_pos,
-                                        tiled_sender_idx,
-                                        tiled_hidden_idx);
+        // one neighbourhood query per tile for every population, split by population afterwards
+        tiles.query_box_out(lo, hi, ws.cull_found, ws.near_candidates);
+        raytrace_workspace::reserve(ws.near_candidate_pos, {0, 3}, pos_opts);
+        torch::index_select_out(ws.near_candidate_pos, all_pos, 0, ws.near_candidates);
+        filter_rays_out(occluder_reach, center, ws.near_candidate_pos, ws.near_candidates, ws, ws.near_pos, ws.near_idx);
+        Tensor members = tiles.cell_members(tile);
+        for (int64_t p = 0; p < num_pop; ++p) {
+            Tensor near_rows = range_rows_(ws.near_idx, offset[p], offset[p + 1], ws);
+            raytrace_workspace::reserve(ws.pop_near_idx[p], {0}, idx_opts);
+            torch::index_select_out(ws.pop_near_idx[p], ws.near_idx, 0, near_rows).sub_(offset[p]);
+            raytrace_workspace::reserve(ws.pop_near_pos[p], {0, 3}, pos_opts);
+            torch::index_select_out(ws.pop_near_pos[p], ws.near_pos, 0, near_rows);
+            Tensor member_rows = range_rows_(members, offset[p], offset[p + 1], ws);
+            raytrace_workspace::reserve(ws.pop_members[p], {0}, idx_opts);
+            torch::index_select_out(ws.pop_members[p], members, 0, member_rows).sub_(offset[p]);
         }
-        if (tiled_hidden_idx.size(0) == 0 || tiled_sender_idx.size(0) == 0) {
-            continue; // no rays found after intersection
+
+        // one glia query per tile, shared by all classes; glia indices are their grid point indices
+        glia_grid.query_box_out(lo, hi, ws.cull_found, ws.near_candidates);
+        raytrace_workspace::reserve(ws.near_candidate_pos, {0, 3}, glia_pos.options());
+        torch::index_select_out(ws.near_candidate_pos, glia_pos, 0, ws.near_candidates);
+        filter_rays_out(occluder_reach, center, ws.near_candidate_pos, ws.near_candidates, ws, ws.near_glia_pos, ws.near_glia_idx);
+
+        for (size_t c = 0; c < classes.size(); ++c) {
+            int64_t s = classes[c].sender;
+            int64_t r = classes[c].receiver;
+            if (ws.pop_members[r].size(0) == 0 || ws.pop_near_idx[s].size(0) == 0)
+                continue;
+            raytrace_workspace::reserve(ws.hidden_idx, {ws.pop_members[r].size(0)}, idx_opts).copy_(ws.pop_members[r]);
+            raytrace_workspace::reserve(ws.hidden_pos, {0, 3}, pos_opts);
+            torch::index_select_out(ws.hidden_pos, populations[r], 0, ws.pop_members[r]);
+            raytrace_workspace::reserve(ws.sender_idx, {ws.pop_near_idx[s].size(0)}, idx_opts).copy_(ws.pop_near_idx[s]);
+            raytrace_workspace::reserve(ws.sender_pos, {ws.pop_near_pos[s].size(0), 3}, pos_opts).copy_(ws.pop_near_pos[s]);
+
+            // trace_bundle appends to ws.WRowIdx / ws.WColIdx, hand it this class's edges
+            std::swap(ws.WRowIdx, rows[c]);
+            std::swap(ws.WColIdx, cols[c]);
+            trace_bundle(ws, model_info, ws.near_glia_pos, ws.pop_near_pos[r]);
+            std::swap(ws.WRowIdx, rows[c]);
+            std::swap(ws.WColIdx, cols[c]);
         }
+    }
+
+    // as in the coverage schedule every ray of a class is traced once, so each class is sorted once at the end
+    std::vector<std::tuple<Tensor, Tensor>> result;
+    for (size_t c = 0; c < classes.size(); ++c) {
+        Tensor WRowIdx, WColIdx;
+        dedup_and_sort_out(rows[c], cols[c], ws, WRowIdx, WColIdx);
+        result.emplace_back(WRowIdx, WColIdx);
+    }
+    return result;
+}
+
+// append the pair keys row * num_cols + col of the rays held in ws.ray_end_idx / ws.ray_start_idx to keys
+static void append_ray_keys_(Tensor &keys, raytrace_workspace &ws, int64_t num_cols) {
+    Tensor &hash = raytrace_workspace::reserve(ws.hash, {ws.ray_end_idx.size(0)}, ws.ray_end_idx.options());
+    hash.copy_(ws.ray_end_idx).mul_(num_cols).add_(ws.ray_start_idx);
+    append_rows_(keys, hash);
+}
+
+// Function to replace the edges of the touched rows of a sorted edge list, the other rows are copied through as blocks
+// prev_row/prev_col [E] sorted and deduplicated, touched_rows [R] sorted unique, removed [D] neurons to drop
+// tested_hash [T] sorted unique keys row * num_cols + col of the re-traced pairs, accepted_hash [A] sorted unique
+// subset of it that passed; every key lies in a touched row
+// A previous edge of a touched row survives unless its row or (with senders_removed) its sender was removed,
+// or its pair was re-traced and failed; besides the block copies the work is O(R log E + D + T + A) plus the
+// previous edges of the touched rows
+// Output (WRowIdx, WColIdx) sorted and deduplicated, on the device of prev_row
+static std::tuple<Tensor, Tensor> splice_retraced(const Tensor &prev_row,
+                                                  const Tensor &prev_col,
+                                                  const Tensor &touched_rows,
+                                                  const Tensor &removed,
+                                                  bool senders_removed,
+                                                  const Tensor &tested_hash,
+                                                  const Tensor &accepted_hash,
+                                                  int64_t num_cols) {
+    Tensor row = prev_row.to(torch::kCPU).contiguous();
+    Tensor col = prev_col.to(torch::kCPU).contiguous();
+    Tensor touched = touched_rows.to(torch::kCPU).contiguous();
+    Tensor dead = std::get<0>(removed.to(torch::kCPU).sort()).contiguous();
+    Tensor tested = tested_hash.to(torch::kCPU).contiguous();
+    Tensor accepted = accepted_hash.to(torch::kCPU).contiguous();
+    const int64_t *pr = row.data_ptr<int64_t>();
+    const int64_t *pc = col.data_ptr<int64_t>();
+    const int64_t *r = touched.data_ptr<int64_t>();
+    const int64_t *d = dead.data_ptr<int64_t>();
+    const int64_t *t = tested.data_ptr<int64_t>();
+    const int64_t *a = accepted.data_ptr<int64_t>();
+    int64_t num_prev = row.size(0);
+    int64_t num_touched = touched.size(0);
+    int64_t num_dead = dead.size(0);
+    int64_t num_tested = tested.size(0);
+    int64_t num_accepted = accepted.size(0);
+    auto is_dead = [&](int64_t idx) { return std::binary_search(d, d + num_dead, idx); };
+
+    Tensor out_row = torch::empty({num_prev + num_accepted}, row.options());
+    Tensor out_col = torch::empty({num_prev + num_accepted}, row.options());
+    int64_t *qr = out_row.data_ptr<int64_t>();
+    int64_t *qc = out_col.data_ptr<int64_t>();
+    int64_t i = 0, j = 0, k = 0, n = 0;
+    for (int64_t u = 0; u < num_touched; ++u) {
+        int64_t start = std::lower_bound(pr + i, pr + num_prev, r[u]) - pr;
+        int64_t end = std::upper_bound(pr + start, pr + num_prev, r[u]) - pr;
+        std::copy(pr + i, pr + start, qr + n);
+        std::copy(pc + i, pc + start, qc + n);
+        n += start - i;
+        i = end;
+        if (is_dead(r[u]))
+            continue; // removed rows lose every edge and are never re-traced
 
-        // glial cells intersection
-        Tensor glia_radius =
-            torch::full({glia_pos.size(0)},
-                        model_info.neuron_rad,
-                        torch::TensorOptions().dtype(torch::kFloat).device(glia_pos.device())); // glia radius should be the same as neuron radius
-        int64_t raytrace_batch_size = 1 + RAYTRACE_LIMIT / tiled_sender_pos.size(0);
-        line_sphere_intersect_batch(raytrace_batch_size,
-                                    MAX_ALLOWED_HITS_GLIA,
-                                    glia_pos,
-                                    glia_radius,
-                                    tiled_sender_pos,
-                                    tiled_hidden_pos,
-                                    tiled_sender_idx,
-                                    tiled_hidden_idx);
-        if (tiled_hidden_idx.size(0) == 0 || tiled_sender_idx.size(0) == 0) {
-            continue; // no rays found after glia intersection
+        // merge the previous edges of the row with its accepted pairs, both sorted by col
+        int64_t row_key = r[u] * num_cols;
+        int64_t next_row_key = row_key + num_cols;
+        int64_t p = start;
+        while (p < end || (k < num_accepted && a[k] < next_row_key)) {
+            int64_t prev_key = p < end ? row_key + pc[p] : next_row_key;
+            if (k == num_accepted || a[k] >= next_row_key || prev_key < a[k]) {
+                // a previous edge survives unless its sender was removed or it was traced again and failed
+                while (j < num_tested && t[j] < prev_key)
+                    ++j;
+                bool failed = j < num_tested && t[j] == prev_key;
+                if (!failed && !(senders_removed && is_dead(pc[p]))) {
+                    qr[n] = r[u];
+                    qc[n] = pc[p];
+                    ++n;
+                }
+                ++p;
+            } else {
+                if (prev_key == a[k])
+                    ++p;
+                qr[n] = r[u];
+                qc[n] = a[k] - row_key;
+                ++n;
+                ++k;
+            }
         }
-        WColIdx = torch::cat({WColIdx, tiled_sender_idx}, 0); // WColIdx is the sender neuron index
-        WRowIdx = torch::cat({WRowIdx, tiled_hidden_idx}, 0); // WRowIdx is the hidden neuron index
-        dedup_and_sort(WRowIdx, WColIdx);
-
-        if (WRowIdx.size(0) > round_prev_con_num) {
-            round_prev_con_num = WRowIdx.size(0);
-            same_counter = 0;
-        } else
-            same_counter++;
-        if (same_counter > MAX_SAME_COUNTER) {
-            break;
-        } // if we have not found new connections for some (default 5) rounds, we can stop
     }
-    // deduplicate and sort the rays
-    if (prev_WRowIdx.has_value() && prev_WColIdx.has_value()) {
-        assert(prev_WColIdx.value().size(0) == prev_WRowIdx.value().size(0));
+    assert(k == num_accepted);
+    std::copy(pr + i, pr + num_prev, qr + n);
+    std::copy(pc + i, pc + num_prev, qc + n);
+    n += num_prev - i;
+    return {out_row.narrow(0, 0, n).to(prev_row.device()), out_col.narrow(0, 0, n).to(prev_row.device())};
+}
 
-        WRowIdx = torch::cat({prev_WRowIdx.value(), WRowIdx}, 0);
-        WColIdx = torch::cat({prev_WColIdx.value(), WColIdx}, 0);
-        dedup_and_sort(WRowIdx, WColIdx);
-    } else {
-        dedup_and_sort(WRowIdx, WColIdx);
+// Function to update an existing edge list after neurons were inserted into or removed from hidden_pos
+// Only rays whose validity can change are traced: a ray is at most con_rad long and an occluder only
+// touches it within neuron_rad, so every affected ray has both ends within con_rad + neuron_rad of a
+// changed neuron and every relevant occluder lies within con_rad + 2*neuron_rad of it.
+// The same bound keeps every edge that can change (including the edges sent by removed neurons) in the rows
+// near the changed neurons, so only those rows are rewritten and the others are copied through unchanged.
+// new_hidden_idx [K] indices into hidden_pos of inserted neurons
+// removed_hidden_idx [R] indices into hidden_pos of neurons to drop; they stay in hidden_pos but no longer
+// send, receive or occlude rays, compacting the arrays is left to the caller
+// When sender_pos is the same tensor as hidden_pos the indices apply to the senders as well
+// prev_WRowIdx/prev_WColIdx must be sorted and deduplicated as raytrace_distance_limited outputs them, with
+// every edge shorter than con_rad; the re-traced pairs are sorted on their own and spliced into the touched rows
+// Temporaries live in a workspace local to the call, pass a raytrace_workspace to reuse them across calls
+// Output (WRowIdx, WColIdx) sorted and deduplicated as in raytrace_distance_limited
+std::tuple<torch::Tensor, torch::Tensor> raytrace::raytrace_incremental(const modeldata &model_info,
+                                                                        const torch::Tensor &glia_pos,
+                                                                        const torch::Tensor &sender_pos,
+                                                                        const torch::Tensor &hidden_pos,
+                                                                        const torch::Tensor &prev_WRowIdx,
+                                                                        const torch::Tensor &prev_WColIdx,
+                                                                        const torch::Tensor &new_hidden_idx,
+                                                                        const std::optional<torch::Tensor> &removed_hidden_idx) {
+    raytrace_workspace ws;
+    return raytrace_incremental(ws, model_info, glia_pos, sender_pos, hidden_pos, prev_WRowIdx, prev_WColIdx, new_hidden_idx, removed_hidden_idx);
+}
+
+std::tuple<torch::Tensor, torch::Tensor> raytrace::raytrace_incremental(raytrace_workspace &ws,
+                                                                        const modeldata &model_info,
+                                                                        const torch::Tensor &glia_pos,
+                                                                        const torch::Tensor &sender_pos,
+                                                                        const torch::Tensor &hidden_pos,
+                                                                        const torch::Tensor &prev_WRowIdx,
+                                                                        const torch::Tensor &prev_WColIdx,
+                                                                        const torch::Tensor &new_hidden_idx,
+                                                                        const std::optional<torch::Tensor> &removed_hidden_idx) {
+    assert(prev_WRowIdx.size(0) == prev_WColIdx.size(0));
+    float con_rad = model_info.con_rad;
+    float neuron_rad = model_info.neuron_rad;
+    float reach = con_rad + neuron_rad;
+    bool shared = sender_pos.is_same(hidden_pos);
+    auto long_opts = torch::TensorOptions().dtype(torch::kLong).device(hidden_pos.device());
+
+    Tensor removed = removed_hidden_idx.has_value() ? removed_hidden_idx.value().to(long_opts) : torch::empty({0}, long_opts);
+    Tensor added = new_hidden_idx.to(long_opts);
+    Tensor WRowIdx = prev_WRowIdx.to(long_opts);
+    Tensor WColIdx = prev_WColIdx.to(long_opts);
+
+    Tensor seed_pos = hidden_pos.index_select(0, torch::cat({added, removed}, 0)); // [K+R,3]
+    if (seed_pos.size(0) == 0)
+        return {WRowIdx, WColIdx};
+
+    // one linear pass over the positions restricts every population to the neighbourhood of the seeds
+    float margin = reach + neuron_rad;
+    Tensor lo = std::get<0>(seed_pos.min(0)) - margin;
+    Tensor hi = std::get<0>(seed_pos.max(0)) + margin;
+    auto in_box = [&](const Tensor &pos) { return ((pos >= lo) & (pos <= hi)).all(1).nonzero().squeeze(1); };
+    auto without_removed = [&](const Tensor &idx) { return idx.masked_select(torch::isin(idx, removed).logical_not()); };
+    // every row whose edges can change lies in the box, the removed ones included
+    Tensor touched_rows = in_box(hidden_pos);
+    Tensor local_hidden_idx = without_removed(touched_rows);
+    Tensor local_hidden_pos = hidden_pos.index_select(0, local_hidden_idx);
+    Tensor local_sender_idx = shared ? local_hidden_idx : in_box(sender_pos);
+    Tensor local_sender_pos = shared ? local_hidden_pos : sender_pos.index_select(0, local_sender_idx);
+    Tensor local_glia_idx = in_box(glia_pos);
+    Tensor local_glia_pos = glia_pos.index_select(0, local_glia_idx);
+
+    int64_t num_cols = sender_pos.size(0);
+    // keys of every pair traced here and of those that passed, accumulated unsorted
+    Tensor &tested = raytrace_workspace::reserve(ws.cat_row, {0}, long_opts);
+    Tensor &accepted = raytrace_workspace::reserve(ws.cat_col, {0}, long_opts);
+
+    for (int64_t s = 0; s < seed_pos.size(0); ++s) {
+        Tensor cur_center = seed_pos.slice(0, s, s + 1); // [1,3]
+        filter_rays_out(reach, cur_center, local_sender_pos, local_sender_idx, ws, ws.sender_pos, ws.sender_idx);
+        if (ws.sender_pos.size(0) == 0)
+            continue;
+        filter_rays_out(reach, cur_center, local_hidden_pos, local_hidden_idx, ws, ws.hidden_pos, ws.hidden_idx);
+        if (ws.hidden_pos.size(0) == 0)
+            continue;
+
+        rays_from_neuronsA_to_neuronsB_out(con_rad,
+                                           ws.sender_pos,
+                                           ws.hidden_pos,
+                                           ws.sender_idx,
+                                           ws.hidden_idx,
+                                           ws,
+                                           ws.ray_start,
+                                           ws.ray_end,
+                                           ws.ray_start_idx,
+                                           ws.ray_end_idx);
+        if (ws.ray_start_idx.size(0) == 0)
+            continue;
+        // every pair traced here is re-decided, whatever the previous edge list said about it
+        append_ray_keys_(tested, ws, num_cols);
+
+        int64_t raytrace_batch_size = 1 + RAYTRACE_LIMIT / ws.ray_start.size(0);
+        if (model_info.ray_neuron_intersect) {
+            filter_rays_out(margin, cur_center, local_hidden_pos, local_hidden_idx, ws, ws.occluder_pos, ws.occluder_idx);
+            Tensor hidden_radius = ws.radius_for(ws.occluder_pos.size(0), neuron_rad, ws.occluder_pos.options());
+            memory_scope scope("neuron_occlusion");
+            line_sphere_intersect_batch_out(raytrace_batch_size,
+                                            MAX_ALLOWED_HITS_NEURON,
+                                            ws.occluder_pos,
+                                            hidden_radius,
+                                            ws,
+                                            ws.ray_start,
+                                            ws.ray_end,
+                                            ws.ray_start_idx,
+                                            ws.ray_end_idx,
+                                            model_info.ray_low_precision);
+            if (ws.ray_start_idx.size(0) == 0)
+                continue;
+        }
+
+        filter_rays_out(margin, cur_center, local_glia_pos, local_glia_idx, ws, ws.glia_occluder_pos, ws.occluder_idx);
+        Tensor glia_radius = ws.radius_for(ws.glia_occluder_pos.size(0), neuron_rad, ws.glia_occluder_pos.options());
+        {
+            memory_scope scope("glia_occlusion");
+            line_sphere_intersect_batch_out(raytrace_batch_size,
+                                            MAX_ALLOWED_HITS_GLIA,
+                                            ws.glia_occluder_pos,
+                                            glia_radius,
+                                            ws,
+                                            ws.ray_start,
+                                            ws.ray_end,
+                                            ws.ray_start_idx,
+                                            ws.ray_end_idx,
+                                            model_info.ray_low_precision);
+        }
+        if (ws.ray_start_idx.size(0) == 0)
+            continue;
+        append_ray_keys_(accepted, ws, num_cols);
     }
-    return {WRowIdx, WColIdx};
-}
\ No newline at end of file
+
+    // the seeds' neighbourhoods overlap, so the traced pairs are deduplicated, at a cost proportional to the change
+    Tensor tested_hash = std::get<0>(torch::_unique(tested, true, false));
+    Tensor accepted_hash = std::get<0>(torch::_unique(accepted, true, false));
+    return splice_retraced(WRowIdx, WColIdx, touched_rows, removed, shared, tested_hash, accepted_hash, num_cols);
+}
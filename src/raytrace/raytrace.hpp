@@ -1,8 +1,10 @@
 #pragma once
 
+#include "pair_memo.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <torch/torch.h>
+#include <vector>
 
 struct modeldata {
     int64_t neuron_size;
@@ -21,10 +23,97 @@ struct modeldata {
     float neuron_std;
     float sphere_rad;
     float con_rad;
+    // plan raytrace batch centres by tiling the hidden neurons instead of random sampling;
+    // every candidate ray is traced exactly once and ray_max_rounds is not used
+    bool ray_coverage_schedule = false;
+    // run the occlusion tests in float16 and re-test only borderline pairs in float32, same result;
+    // applies to CUDA tensors only, CPU runs stay in float32 where it is faster
+    bool ray_low_precision = false;
+    // spill the accumulated edges of raytrace_distance_limited to sorted runs on disk once they exceed this many
+    // bytes and merge them at the end, 0 keeps everything in memory; runs go to $RAYBNN_SPILL_DIR or the temp dir.
+    // Spilling always uses the coverage schedule, whose tiles trace every candidate ray exactly once
+    int64_t ray_spill_bytes = 0;
+    // return a spilled result as mmapped tensors instead of reading it back into memory
+    bool ray_spill_mmap = false;
+    // remember the pairs traced by earlier rounds of the random schedule and skip them before the occlusion tests
+    bool ray_pair_memo = false;
+};
+
+// Calls visit(name, field) for every modeldata field; archives and the worker protocol store modeldata
+// field by field through it, so they survive new fields with defaults
+template <typename Visit>
+inline void visit_modeldata(modeldata &m, Visit &&visit) {
+    visit("neuron_size", m.neuron_size);
+    visit("input_size", m.input_size);
+    visit("output_size", m.output_size);
+    visit("proc_num", m.proc_num);
+    visit("active_size", m.active_size);
+    visit("batch_size", m.batch_size);
+    visit("ray_input_connection_num", m.ray_input_connection_num);
+    visit("ray_max_rounds", m.ray_max_rounds);
+    visit("ray_glia_intersect", m.ray_glia_intersect);
+    visit("ray_neuron_intersect", m.ray_neuron_intersect);
+    visit("neuron_rad", m.neuron_rad);
+    visit("time_step", m.time_step);
+    visit("nration", m.nration);
+    visit("neuron_std", m.neuron_std);
+    visit("sphere_rad", m.sphere_rad);
+    visit("con_rad", m.con_rad);
+    visit("ray_coverage_schedule", m.ray_coverage_schedule);
+    visit("ray_low_precision", m.ray_low_precision);
+    visit("ray_spill_bytes", m.ray_spill_bytes);
+    visit("ray_spill_mmap", m.ray_spill_mmap);
+    visit("ray_pair_memo", m.ray_pair_memo);
+}
+
+// Grow-only buffers reused by the out-style raytrace functions across rounds and calls
+// Buffers are resized with resize_, which only reallocates when a request exceeds the current storage,
+// so once the largest round has been seen the round loop stops allocating tensor storage.
+struct raytrace_workspace {
+    // filter_rays_out
+    torch::Tensor filter_diff, filter_dist, filter_mask, filter_nz;
+    // rays_from_neuronsA_to_neuronsB_out
+    torch::Tensor pair_diff, pair_dist, pair_mask, pair_nz;
+    // line_sphere_intersect_out
+    torch::Tensor line_dir, line_dir_sq, line_dir_prod, block_diff, block_dot, block_radius_sq;
+    // line_sphere_intersect_mixed_out, float16 first pass and float32 recheck of the borderline pairs
+    torch::Tensor lp_bounds, lp_bounds_cpu, lp_origin, lp_radius_max, lp_scaled, lp_start, lp_dir, lp_dir_prod, lp_dir_sq;
+    torch::Tensor lp_cells_scaled, lp_cells, lp_work, lp_ratio, lp_dist, lp_radius, lp_borderline, lp_short, lp_pairs;
+    torch::Tensor lp_sel_start, lp_sel_dir, lp_sel_block, lp_pair_work, lp_pair_ratio, lp_pair_scalar, lp_exact;
+    // line_sphere_intersect_batch_out
+    torch::Tensor mask, mask_count, hits, hits_delta, keep_mask, keep_idx, compact_pos, compact_idx;
+    // dedup_and_sort_out
+    torch::Tensor max_col, hash, sorted_hash, sort_perm, unique_mask;
+    // cell radius shared by neurons and glia
+    torch::Tensor radius;
+    float radius_value = 0.0f;
+    // per-round results of raytrace_distance_limited
+    torch::Tensor sender_pos, sender_idx, hidden_pos, hidden_idx;
+    // occluders near the current ray bundle
+    torch::Tensor occluder_pos, occluder_idx, glia_occluder_pos, cull_bounds, cull_bounds_cpu, cull_idx;
+    std::vector<int64_t> cull_found;
+    torch::Tensor ray_start, ray_end, ray_start_idx, ray_end_idx;
+    // grid neighbourhood of the current coverage tile, raytrace_fused splits it by population
+    torch::Tensor near_candidates, near_candidate_pos, near_pos, near_idx, near_glia_pos, near_glia_idx;
+    torch::Tensor range_mask, range_below, range_nz;
+    std::vector<torch::Tensor> pop_near_pos, pop_near_idx, pop_members;
+    torch::Tensor WRowIdx, WColIdx, cat_row, cat_col;
+
+    static torch::Tensor &reserve(torch::Tensor &buf, torch::IntArrayRef sizes, const torch::TensorOptions &options);
+    torch::Tensor radius_for(int64_t num_cells, float value, const torch::TensorOptions &options);
+};
+
+// One connection class of a fused build: rays from populations[sender] to populations[receiver]
+struct connection_class {
+    int64_t sender;
+    int64_t receiver;
 };
 
 class raytrace {
 public:
+    // pair memo lookups of the last raytrace_distance_limited call, see modeldata::ray_pair_memo
+    pair_memo_stats memo_stats;
+
     static std::pair<torch::Tensor, torch::Tensor>
     filter_rays(const float con_rad, const torch::Tensor &target_pos, const torch::Tensor &input_pos, const torch::Tensor &input_idx);
 
@@ -39,6 +128,11 @@ public:
                                                const torch::Tensor &block_cells,
                                                const torch::Tensor &block_radius);
 
+    static torch::Tensor line_sphere_intersect_mixed(const torch::Tensor &line_start,
+                                                     const torch::Tensor &line_end,
+                                                     const torch::Tensor &block_cells,
+                                                     const torch::Tensor &block_radius);
+
     static void line_sphere_intersect_batch(const int64_t batch_size,
                                             const int64_t max_allowed_hits,
                                             const torch::Tensor &block_cells,
@@ -47,10 +141,101 @@ public:
                                             torch::Tensor &line_end,
                                             torch::Tensor &index_start,
                                             torch::Tensor &index_end);
+
+    static void dedup_and_sort(torch::Tensor &WRowIdx, torch::Tensor &WColIdx);
+
+    static void filter_rays_out(const float con_rad,
+                                const torch::Tensor &target_pos,
+                                const torch::Tensor &input_pos,
+                                const torch::Tensor &input_idx,
+                                raytrace_workspace &ws,
+                                torch::Tensor &res_pos,
+                                torch::Tensor &res_idx);
+
+    static void rays_from_neuronsA_to_neuronsB_out(const float con_rad,
+                                                   const torch::Tensor &pos_A,
+                                                   const torch::Tensor &pos_B,
+                                                   const torch::Tensor &idx_A,
+                                                   const torch::Tensor &idx_B,
+                                                   raytrace_workspace &ws,
+                                                   torch::Tensor &tiled_pos_A,
+                                                   torch::Tensor &tiled_pos_B,
+                                                   torch::Tensor &tiled_idx_A,
+                                                   torch::Tensor &tiled_idx_B);
+
+    static void line_sphere_intersect_out(const torch::Tensor &line_start,
+                                          const torch::Tensor &line_end,
+                                          const torch::Tensor &block_cells,
+                                          const torch::Tensor &block_radius,
+                                          raytrace_workspace &ws,
+                                          torch::Tensor &mask);
+
+    static void line_sphere_intersect_mixed_out(const torch::Tensor &line_start,
+                                                const torch::Tensor &line_end,
+                                                const torch::Tensor &block_cells,
+                                                const torch::Tensor &block_radius,
+                                                raytrace_workspace &ws,
+                                                torch::Tensor &mask);
+
+    static void line_sphere_intersect_batch_out(const int64_t batch_size,
+                                                const int64_t max_allowed_hits,
+                                                const torch::Tensor &block_cells,
+                                                const torch::Tensor &block_radius,
+                                                raytrace_workspace &ws,
+                                                torch::Tensor &line_start,
+                                                torch::Tensor &line_end,
+                                                torch::Tensor &index_start,
+                                                torch::Tensor &index_end,
+                                                const bool low_precision = false);
+
+    static void dedup_and_sort_out(const torch::Tensor &in_WRowIdx,
+                                   const torch::Tensor &in_WColIdx,
+                                   raytrace_workspace &ws,
+                                   torch::Tensor &WRowIdx,
+                                   torch::Tensor &WColIdx);
+
     std::tuple<torch::Tensor, torch::Tensor> raytrace_distance_limited(const modeldata &model_info,
                                                                        const torch::Tensor &glia_pos,
                                                                        const torch::Tensor &sender_pos,
                                                                        const torch::Tensor &receiver_pos,
                                                                        const std::optional<torch::Tensor> &prev_WRowIdx = std::nullopt,
                                                                        const std::optional<torch::Tensor> &prev_WColIdx = std::nullopt);
+
+    std::tuple<torch::Tensor, torch::Tensor> raytrace_distance_limited(raytrace_workspace &ws,
+                                                                       const modeldata &model_info,
+                                                                       const torch::Tensor &glia_pos,
+                                                                       const torch::Tensor &sender_pos,
+                                                                       const torch::Tensor &receiver_pos,
+                                                                       const std::optional<torch::Tensor> &prev_WRowIdx = std::nullopt,
+                                                                       const std::optional<torch::Tensor> &prev_WColIdx = std::nullopt);
+
+    std::vector<std::tuple<torch::Tensor, torch::Tensor>> raytrace_fused(const modeldata &model_info,
+                                                                         const torch::Tensor &glia_pos,
+                                                                         const std::vector<torch::Tensor> &populations,
+                                                                         const std::vector<connection_class> &classes);
+
+    std::vector<std::tuple<torch::Tensor, torch::Tensor>> raytrace_fused(raytrace_workspace &ws,
+                                                                         const modeldata &model_info,
+                                                                         const torch::Tensor &glia_pos,
+                                                                         const std::vector<torch::Tensor> &populations,
+                                                                         const std::vector<connection_class> &classes);
+
+    std::tuple<torch::Tensor, torch::Tensor> raytrace_incremental(const modeldata &model_info,
+                                                                  const torch::Tensor &glia_pos,
+                                                                  const torch::Tensor &sender_pos,
+                                                                  const torch::Tensor &receiver_pos,
+                                                                  const torch::Tensor &prev_WRowIdx,
+                                                                  const torch::Tensor &prev_WColIdx,
+                                                                  const torch::Tensor &new_receiver_idx,
+                                                                  const std::optional<torch::Tensor> &removed_receiver_idx = std::nullopt);
+
+    std::tuple<torch::Tensor, torch::Tensor> raytrace_incremental(raytrace_workspace &ws,
+                                                                  const modeldata &model_info,
+                                                                  const torch::Tensor &glia_pos,
+                                                                  const torch::Tensor &sender_pos,
+                                                                  const torch::Tensor &receiver_pos,
+                                                                  const torch::Tensor &prev_WRowIdx,
+                                                                  const torch::Tensor &prev_WColIdx,
+                                                                  const torch::Tensor &new_receiver_idx,
+                                                                  const std::optional<torch::Tensor> &removed_receiver_idx = std::nullopt);
 };
\ No newline at end of file
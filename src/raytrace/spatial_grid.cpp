@@ -0,0 +1,104 @@
+#include "spatial_grid.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace torch;
+
+// pos [N,3], cell_size > 0
+spatial_grid::spatial_grid(const torch::Tensor &pos, float cell_size) : cell_size_(cell_size) {
+    assert(cell_size > 0);
+    auto long_opts = torch::TensorOptions().dtype(torch::kLong);
+    cell_start_.push_back(0);
+    if (pos.size(0) == 0) {
+        order_ = torch::empty({0}, long_opts.device(pos.device()));
+        cell_centers_ = torch::empty({0, 3}, pos.options());
+        return;
+    }
+
+    Tensor pos_cpu = pos.to(torch::kCPU, torch::kFloat).contiguous();
+    Tensor origin = std::get<0>(pos_cpu.min(0)); // [3]
+    Tensor cell = torch::floor((pos_cpu - origin) / cell_size).to(torch::kLong); // [N,3]
+    Tensor dims = std::get<0>(cell.max(0)) + 1;
+    for (int d = 0; d < 3; ++d) {
+        origin_[d] = origin[d].item<float>();
+        dims_[d] = dims[d].item<int64_t>();
+    }
+
+    Tensor key = (cell.select(1, 0) * dims_[1] + cell.select(1, 1)) * dims_[2] + cell.select(1, 2); // [N]
+    auto [sorted_key, order] = torch::sort(key, /*stable=*/true, /*dim=*/0, /*descending=*/false);
+    auto [unique_key, _, counts] = torch::unique_consecutive(sorted_key, false, true);
+
+    int64_t num = unique_key.size(0);
+    const int64_t *key_ptr = unique_key.data_ptr<int64_t>();
+    const int64_t *count_ptr = counts.data_ptr<int64_t>();
+    cell_keys_.assign(key_ptr, key_ptr + num);
+    for (int64_t c = 0; c < num; ++c)
+        cell_start_.push_back(cell_start_.back() + count_ptr[c]);
+    order_cpu_.assign(order.data_ptr<int64_t>(), order.data_ptr<int64_t>() + order.size(0));
+
+    Tensor cz = unique_key % dims_[2];
+    Tensor cy = torch::div(unique_key, dims_[2], "floor") % dims_[1];
+    Tensor cx = torch::div(unique_key, dims_[1] * dims_[2], "floor");
+    Tensor centers = (torch::stack({cx, cy, cz}, 1).to(torch::kFloat) + 0.5f) * cell_size + origin;
+
+    order_ = order.to(pos.device());
+    cell_centers_ = centers.to(pos.options());
+}
+
+std::array<float, 3> spatial_grid::cell_center_coords(int64_t c) const {
+    int64_t key = cell_keys_[c];
+    std::array<int64_t, 3> cell = {key / (dims_[1] * dims_[2]), (key / dims_[2]) % dims_[1], key % dims_[2]};
+    std::array<float, 3> center{};
+    for (int d = 0; d < 3; ++d)
+        center[d] = (static_cast<float>(cell[d]) + 0.5f) * cell_size_ + origin_[d];
+    return center;
+}
+
+void spatial_grid::collect_box(const std::array<float, 3> &lo, const std::array<float, 3> &hi, std::vector<int64_t> &found) const {
+    std::array<int64_t, 3> c0{};
+    std::array<int64_t, 3> c1{};
+    for (int d = 0; d < 3; ++d) {
+        c0[d] = std::max<int64_t>(0, static_cast<int64_t>(std::floor((lo[d] - origin_[d]) / cell_size_)));
+        c1[d] = std::min<int64_t>(dims_[d] - 1, static_cast<int64_t>(std::floor((hi[d] - origin_[d]) / cell_size_)));
+    }
+
+    for (int64_t x = c0[0]; x <= c1[0]; ++x) {
+        for (int64_t y = c0[1]; y <= c1[1]; ++y) {
+            // the z-run of a fixed (x,y) column is a contiguous key range
+            int64_t first = (x * dims_[1] + y) * dims_[2] + c0[2];
+            int64_t last = (x * dims_[1] + y) * dims_[2] + c1[2];
+            auto it = std::lower_bound(cell_keys_.begin(), cell_keys_.end(), first);
+            for (; it != cell_keys_.end() && *it <= last; ++it) {
+                int64_t c = it - cell_keys_.begin();
+                found.insert(found.end(), order_cpu_.begin() + cell_start_[c], order_cpu_.begin() + cell_start_[c + 1]);
+            }
+        }
+    }
+}
+
+torch::Tensor spatial_grid::query_box(const std::array<float, 3> &lo, const std::array<float, 3> &hi) const {
+    std::vector<int64_t> found;
+    collect_box(lo, hi, found);
+    Tensor res = torch::from_blob(found.data(), {static_cast<int64_t>(found.size())}, torch::TensorOptions().dtype(torch::kLong));
+    return res.clone().to(order_.device());
+}
+
+void spatial_grid::query_box_out(const std::array<float, 3> &lo,
+                                 const std::array<float, 3> &hi,
+                                 std::vector<int64_t> &found,
+                                 torch::Tensor &res) const {
+    found.clear();
+    collect_box(lo, hi, found);
+    int64_t n = static_cast<int64_t>(found.size());
+    if (!res.defined() || res.scalar_type() != torch::kLong || res.device() != order_.device())
+        res = torch::empty({n}, torch::TensorOptions().dtype(torch::kLong).device(order_.device()));
+    else
+        res.resize_({n}); // keeps the storage when it is already large enough
+    if (n == 0)
+        return;
+    if (res.is_cpu())
+        std::copy(found.begin(), found.end(), res.data_ptr<int64_t>());
+    else
+        res.copy_(torch::from_blob(found.data(), {n}, torch::TensorOptions().dtype(torch::kLong)));
+}
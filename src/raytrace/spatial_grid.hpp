@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <torch/torch.h>
+#include <vector>
+
+// Uniform grid over a point set; points are bucketed by cell so neighbourhoods can be looked up
+// without scanning every point. Only occupied cells are stored, sorted by linear cell key.
+class spatial_grid {
+public:
+    spatial_grid(const torch::Tensor &pos, float cell_size);
+
+    int64_t num_cells() const { return static_cast<int64_t>(cell_keys_.size()); }
+    float cell_size() const { return cell_size_; }
+
+    // centre of the c-th occupied cell [1,3]
+    torch::Tensor cell_center(int64_t c) const { return cell_centers_.slice(0, c, c + 1); }
+    // same centre as host coordinates, for query_box
+    std::array<float, 3> cell_center_coords(int64_t c) const;
+    // indices of the points inside the c-th occupied cell [K]
+    torch::Tensor cell_members(int64_t c) const { return order_.slice(0, cell_start_[c], cell_start_[c + 1]); }
+
+    // indices of the points in every cell overlapping the box [lo, hi], a superset of the points inside it
+    torch::Tensor query_box(const std::array<float, 3> &lo, const std::array<float, 3> &hi) const;
+    // same as query_box, collecting into found and writing to res [K]; both keep their storage across calls
+    void query_box_out(const std::array<float, 3> &lo, const std::array<float, 3> &hi, std::vector<int64_t> &found, torch::Tensor &res) const;
+
+private:
+    void collect_box(const std::array<float, 3> &lo, const std::array<float, 3> &hi, std::vector<int64_t> &found) const;
+
+    float cell_size_;
+    std::array<float, 3> origin_{};
+    std::array<int64_t, 3> dims_{};
+    std::vector<int64_t> cell_keys_;  // sorted occupied cell keys
+    std::vector<int64_t> cell_start_; // offsets into order_, num_cells + 1 entries
+    std::vector<int64_t> order_cpu_;  // point indices sorted by cell key
+    torch::Tensor order_;             // same as order_cpu_, on the device of the points
+    torch::Tensor cell_centers_;      // [num_cells,3]
+};
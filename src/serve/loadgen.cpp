@@ -0,0 +1,88 @@
+#include "domain.hpp"
+#include "serve.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+// raybnn_loadgen --socket PATH --input-size I [--clients C] [--requests R] [--seed S]
+// Each client is a closed loop of single-sample requests; client-side latency is reported.
+int main(int argc, char **argv) {
+    std::string socket_path;
+    int64_t input_size = 0;
+    int64_t num_clients = 8;
+    int64_t num_requests = 1000;
+    uint64_t seed = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--socket") == 0)
+            socket_path = argv[i + 1];
+        else if (std::strcmp(argv[i], "--input-size") == 0)
+            input_size = std::atoll(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--clients") == 0)
+            num_clients = std::atoll(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--requests") == 0)
+            num_requests = std::atoll(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--seed") == 0)
+            seed = std::strtoull(argv[i + 1], nullptr, 10);
+    }
+    if (socket_path.empty() || input_size <= 0) {
+        std::cerr << "usage: raybnn_loadgen --socket PATH --input-size I [--clients C] [--requests R] [--seed S]" << std::endl;
+        return 1;
+    }
+    torch::set_num_threads(1);
+
+    std::mutex latencies_mutex;
+    std::vector<double> latencies_ms;
+    std::atomic<int64_t> failures{0};
+
+    auto client = [&](int64_t client_id) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "raybnn_loadgen: cannot connect to " << socket_path << std::endl;
+            failures += num_requests;
+            if (fd >= 0)
+                close(fd);
+            return;
+        }
+        auto gen = at::detail::createCPUGenerator(seed + client_id);
+        torch::Tensor inputs = at::rand({num_requests, input_size}, gen, torch::dtype(torch::kFloat32));
+        std::vector<double> local;
+        local.reserve(num_requests);
+        try {
+            for (int64_t r = 0; r < num_requests; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                domain::write_tensor(fd, inputs[r]);
+                domain::read_tensor(fd);
+                local.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "raybnn_loadgen: client " << client_id << ": " << e.what() << std::endl;
+            failures += num_requests - static_cast<int64_t>(local.size());
+        }
+        close(fd);
+        std::lock_guard<std::mutex> lock(latencies_mutex);
+        latencies_ms.insert(latencies_ms.end(), local.begin(), local.end());
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int64_t c = 0; c < num_clients; ++c)
+        clients.emplace_back(client, c);
+    for (auto &t : clients)
+        t.join();
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // the client cannot see the server's batches
+    latency_report report = summarize_latency(latencies_ms, 0, elapsed_s);
+    std::cout << "raybnn_loadgen: " << num_clients << " clients, " << report << ", failures: " << failures.load() << std::endl;
+    return failures.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#include "serve.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+
+using namespace torch;
+
+// nearest-rank percentiles
+latency_report summarize_latency(std::vector<double> latencies_ms, int64_t batches, double elapsed_s) {
+    latency_report report;
+    report.requests = static_cast<int64_t>(latencies_ms.size());
+    report.batches = batches;
+    if (latencies_ms.empty())
+        return report;
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    auto rank = [&](double q) {
+        size_t idx = static_cast<size_t>(std::ceil(q * latencies_ms.size()));
+        return latencies_ms[std::clamp<size_t>(idx, 1, latencies_ms.size()) - 1];
+    };
+    report.p50_ms = rank(0.50);
+    report.p99_ms = rank(0.99);
+    report.mean_batch = batches > 0 ? static_cast<double>(report.requests) / batches : 0.0;
+    report.throughput = elapsed_s > 0.0 ? report.requests / elapsed_s : 0.0;
+    return report;
+}
+
+std::ostream &operator<<(std::ostream &out, const latency_report &report) {
+    out << std::fixed << std::setprecision(3) << "requests: " << report.requests << " batches: " << report.batches
+        << " mean batch: " << report.mean_batch << " p50: " << report.p50_ms << " ms p99: " << report.p99_ms
+        << " ms throughput: " << report.throughput << " req/s";
+    return out;
+}
+
+micro_batcher::micro_batcher(evaluator eval, int64_t max_batch, std::chrono::microseconds budget)
+    : eval_(std::move(eval)), max_batch_(max_batch), budget_(budget) {
+    assert(max_batch > 0);
+    worker_ = std::thread(&micro_batcher::run, this);
+}
+
+micro_batcher::~micro_batcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+std::future<Tensor> micro_batcher::submit(const Tensor &input) {
+    request req{input, std::promise<Tensor>(), clock::now()};
+    std::future<Tensor> result = req.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_)
+            throw std::runtime_error("micro_batcher: stopped");
+        queue_.push_back(std::move(req));
+    }
+    cv_.notify_one();
+    return result;
+}
+
+void micro_batcher::run() {
+    std::vector<request> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return; // stopped and drained
+            clock::time_point deadline = queue_.front().arrival + budget_;
+            cv_.wait_until(lock, deadline, [&] { return stop_ || static_cast<int64_t>(queue_.size()) >= max_batch_; });
+
+            int64_t take = std::min<int64_t>(max_batch_, queue_.size());
+            for (int64_t i = 0; i < take; ++i) {
+                batch.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+        }
+
+        Tensor output;
+        try {
+            std::vector<Tensor> inputs;
+            inputs.reserve(batch.size());
+            for (auto &req : batch)
+                inputs.push_back(req.input);
+            output = eval_(torch::stack(inputs, 0)); // [B, O]
+            if (output.size(0) != static_cast<int64_t>(batch.size()))
+                throw std::runtime_error("micro_batcher: evaluator returned a wrong batch size");
+        } catch (...) {
+            for (auto &req : batch)
+                req.result.set_exception(std::current_exception());
+            output = Tensor();
+        }
+        if (output.defined()) {
+            for (size_t i = 0; i < batch.size(); ++i)
+                batch[i].result.set_value(output[i]);
+        }
+
+        clock::time_point done = clock::now();
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            if (latencies_ms_.empty())
+                first_arrival_ = batch.front().arrival;
+            for (auto &req : batch)
+                latencies_ms_.push_back(std::chrono::duration<double, std::milli>(done - req.arrival).count());
+            last_done_ = done;
+            batches_ += 1;
+        }
+        batch.clear();
+    }
+}
+
+latency_report micro_batcher::stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    double elapsed_s = std::chrono::duration<double>(last_done_ - first_arrival_).count();
+    return summarize_latency(latencies_ms_, batches_, elapsed_s);
+}
+
+void micro_batcher::reset_stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    latencies_ms_.clear();
+    batches_ = 0;
+}
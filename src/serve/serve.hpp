@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <torch/torch.h>
+#include <vector>
+
+// Latency summary of a set of requests
+struct latency_report {
+    int64_t requests = 0;
+    int64_t batches = 0;
+    double mean_batch = 0.0;
+    double p50_ms = 0.0;
+    double p99_ms = 0.0;
+    double throughput = 0.0; // requests per second between the first arrival and the last completion
+};
+
+latency_report summarize_latency(std::vector<double> latencies_ms, int64_t batches, double elapsed_s);
+std::ostream &operator<<(std::ostream &out, const latency_report &report);
+
+// Coalesces concurrent single-sample requests into micro-batches
+// A batch is dispatched once max_batch requests are queued or the oldest queued request has waited budget,
+// so a lone request pays at most budget of extra latency. Batches are evaluated one at a time on a worker thread.
+class micro_batcher {
+public:
+    using evaluator = std::function<torch::Tensor(const torch::Tensor &)>; // [B, I] -> [B, O]
+
+    micro_batcher(evaluator eval, int64_t max_batch, std::chrono::microseconds budget);
+    ~micro_batcher();
+
+    micro_batcher(const micro_batcher &) = delete;
+    micro_batcher &operator=(const micro_batcher &) = delete;
+
+    // input [I], the future yields [O]
+    std::future<torch::Tensor> submit(const torch::Tensor &input);
+
+    latency_report stats() const;
+    void reset_stats();
+
+private:
+    using clock = std::chrono::steady_clock;
+    struct request {
+        torch::Tensor input;
+        std::promise<torch::Tensor> result;
+        clock::time_point arrival;
+    };
+
+    void run();
+
+    evaluator eval_;
+    int64_t max_batch_;
+    std::chrono::microseconds budget_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<request> queue_;
+    bool stop_ = false;
+
+    mutable std::mutex stats_mutex_;
+    std::vector<double> latencies_ms_;
+    int64_t batches_ = 0;
+    clock::time_point first_arrival_;
+    clock::time_point last_done_;
+
+    std::thread worker_;
+};
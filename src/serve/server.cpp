@@ -0,0 +1,160 @@
+#include "domain.hpp"
+#include "network.hpp"
+#include "serve.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+constexpr int ACCEPT_POLL_MS = 200;
+
+static std::atomic<bool> stop_requested{false};
+
+static void on_signal(int) { stop_requested.store(true); }
+
+// Closed-loop connection: each request is a tensor [I] or [k, I], each reply is [O] or [k, O]
+// A malformed request ends the connection.
+static void serve_connection(int fd, micro_batcher &batcher, int64_t input_size) {
+    try {
+        while (true) {
+            torch::Tensor input;
+            try {
+                input = domain::read_tensor(fd);
+            } catch (const std::exception &) {
+                return; // client closed the connection
+            }
+            bool single = input.dim() == 1;
+            torch::Tensor rows = single ? input.unsqueeze(0) : input;
+            if (rows.dim() != 2 || rows.size(1) != input_size)
+                throw std::runtime_error("expected input of size " + std::to_string(input_size));
+            rows = rows.to(torch::kFloat32);
+
+            std::vector<std::future<torch::Tensor>> pending;
+            for (int64_t i = 0; i < rows.size(0); ++i)
+                pending.push_back(batcher.submit(rows[i]));
+            std::vector<torch::Tensor> outputs;
+            for (auto &f : pending)
+                outputs.push_back(f.get());
+            domain::write_tensor(fd, single ? outputs[0] : torch::stack(outputs, 0));
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "raybnn_server: connection closed: " << e.what() << std::endl;
+    }
+}
+
+// raybnn_server --model PATH --socket PATH [--budget-us N] [--max-batch B] [--threads T] [--report-every S]
+int main(int argc, char **argv) {
+    std::string model_path;
+    std::string socket_path;
+    int64_t budget_us = 2000;
+    int64_t max_batch = 0;
+    int threads = 0;
+    int report_every = 10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--model") == 0)
+            model_path = argv[i + 1];
+        else if (std::strcmp(argv[i], "--socket") == 0)
+            socket_path = argv[i + 1];
+        else if (std::strcmp(argv[i], "--budget-us") == 0)
+            budget_us = std::atoll(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--max-batch") == 0)
+            max_batch = std::atoll(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--threads") == 0)
+            threads = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--report-every") == 0)
+            report_every = std::atoi(argv[i + 1]);
+    }
+    if (model_path.empty() || socket_path.empty()) {
+        std::cerr << "usage: raybnn_server --model PATH --socket PATH [--budget-us N] [--max-batch B] [--threads T] [--report-every S]"
+                  << std::endl;
+        return 1;
+    }
+    if (threads > 0)
+        torch::set_num_threads(threads);
+
+    network net;
+    try {
+        net = network::load(model_path);
+    } catch (const std::exception &e) {
+        std::cerr << "raybnn_server: cannot load " << model_path << ": " << e.what() << std::endl;
+        return 1;
+    }
+    if (max_batch <= 0)
+        max_batch = net.model_info.batch_size > 0 ? net.model_info.batch_size : 1;
+    torch::NoGradGuard no_grad;
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        std::cerr << "raybnn_server: cannot listen on " << socket_path << std::endl;
+        return 1;
+    }
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    micro_batcher batcher(
+        [&net](const torch::Tensor &X) {
+            torch::NoGradGuard guard;
+            return net.forward(X);
+        },
+        max_batch,
+        std::chrono::microseconds(budget_us));
+    std::cout << "raybnn_server: serving " << model_path << " on " << socket_path << " (max batch " << max_batch << ", budget "
+              << budget_us << " us)" << std::endl;
+
+    // connection threads are detached and deregister themselves, so the server does not accumulate threads
+    std::mutex clients_mutex;
+    std::condition_variable clients_done;
+    std::set<int> clients;
+    auto last_report = std::chrono::steady_clock::now();
+    while (!stop_requested.load()) {
+        pollfd pfd{listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, ACCEPT_POLL_MS) > 0 && (pfd.revents & POLLIN)) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                clients.insert(fd);
+                std::thread([fd, &batcher, &net, &clients, &clients_mutex, &clients_done] {
+                    serve_connection(fd, batcher, net.model_info.input_size);
+                    std::lock_guard<std::mutex> guard(clients_mutex);
+                    clients.erase(fd);
+                    close(fd);
+                    clients_done.notify_all();
+                }).detach();
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (report_every > 0 && now - last_report >= std::chrono::seconds(report_every)) {
+            latency_report report = batcher.stats();
+            if (report.requests > 0)
+                std::cout << "raybnn_server: " << report << std::endl;
+            last_report = now;
+        }
+    }
+
+    // unblock the connection threads, they close their own sockets
+    {
+        std::unique_lock<std::mutex> lock(clients_mutex);
+        for (int fd : clients)
+            shutdown(fd, SHUT_RDWR);
+        clients_done.wait(lock, [&] { return clients.empty(); });
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    std::cout << "raybnn_server: " << batcher.stats() << std::endl;
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include "block_sparse.hpp"
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+
+// x86-64 builds carry an AVX-512 copy of the kernels next to the portable one and pick at runtime,
+// so the default (non-native) build still uses AVX-512 on hosts that have it
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define RAYBNN_AVX512_KERNELS
+#define RAYBNN_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// A dense block element is about this many times cheaper than a scattered edge (one 16-lane FMA vs a gather),
+// so a block pays off once it holds b*b / DENSE_BLOCK_SPEEDUP edges; the estimate is for the AVX-512 kernels
+constexpr int64_t DENSE_BLOCK_SPEEDUP = 8;
+
+using namespace torch;
+
+namespace {
+
+// portable kernels, plain loops the compiler vectorises for the build target
+struct scalar_kernels {
+    // y[0:n] += v * x[0:n]
+    static void axpy(int64_t n, float v, const float *x, float *y) {
+        for (int64_t k = 0; k < n; ++k)
+            y[k] += v * x[k];
+    }
+
+    // Y[b, B] += V[b, b] X[b, B], rows of X and Y are B floats apart
+    template <int64_t b>
+    static void block(int64_t B, const float *V, const float *X, float *Y) {
+        if (B == 1) {
+            // single column: one dot product of a block row with the contiguous x segment
+            for (int64_t i = 0; i < b; ++i) {
+                float acc = 0.0f;
+                for (int64_t j = 0; j < b; ++j)
+                    acc += V[i * b + j] * X[j];
+                Y[i] += acc;
+            }
+            return;
+        }
+        for (int64_t i = 0; i < b; ++i)
+            for (int64_t j = 0; j < b; ++j)
+                for (int64_t k = 0; k < B; ++k)
+                    Y[i * B + k] += V[i * b + j] * X[j * B + k];
+    }
+};
+
+#ifdef RAYBNN_AVX512_KERNELS
+struct avx512_kernels {
+    RAYBNN_TARGET_AVX512 static void axpy(int64_t n, float v, const float *x, float *y) {
+        int64_t k = 0;
+        __m512 vv = _mm512_set1_ps(v);
+        for (; k + 16 <= n; k += 16)
+            _mm512_storeu_ps(y + k, _mm512_fmadd_ps(vv, _mm512_loadu_ps(x + k), _mm512_loadu_ps(y + k)));
+        for (; k < n; ++k)
+            y[k] += v * x[k];
+    }
+
+    template <int64_t b>
+    RAYBNN_TARGET_AVX512 static void block(int64_t B, const float *V, const float *X, float *Y) {
+        if (B == 1) {
+            // single column: one dot product of a block row with the contiguous x segment
+            for (int64_t i = 0; i < b; ++i) {
+                if constexpr (b == 16) {
+                    Y[i] += _mm512_reduce_add_ps(_mm512_mul_ps(_mm512_loadu_ps(V + i * b), _mm512_loadu_ps(X)));
+                } else {
+                    float acc = 0.0f;
+                    for (int64_t j = 0; j < b; ++j)
+                        acc += V[i * b + j] * X[j];
+                    Y[i] += acc;
+                }
+            }
+            return;
+        }
+        // 16 batch columns of one output row stay in a register across the whole block row
+        int64_t k = 0;
+        for (; k + 16 <= B; k += 16) {
+            for (int64_t i = 0; i < b; ++i) {
+                __m512 acc = _mm512_loadu_ps(Y + i * B + k);
+                for (int64_t j = 0; j < b; ++j)
+                    acc = _mm512_fmadd_ps(_mm512_set1_ps(V[i * b + j]), _mm512_loadu_ps(X + j * B + k), acc);
+                _mm512_storeu_ps(Y + i * B + k, acc);
+            }
+        }
+        for (int64_t i = 0; i < b; ++i)
+            for (int64_t j = 0; j < b; ++j)
+                for (int64_t kk = k; kk < B; ++kk)
+                    Y[i * B + kk] += V[i * b + j] * X[j * B + kk];
+    }
+};
+
+bool cpu_has_avx512() {
+    static const bool has = __builtin_cpu_supports("avx512f");
+    return has;
+}
+#endif
+
+// blocks that would reach past the last neuron stay scattered, so kernels never read beyond X
+struct block_plan {
+    int64_t block_size;
+    int64_t num_block_cols;
+    std::vector<int64_t> key;   // [E] block key of every edge
+    std::vector<int64_t> count; // edges per block key, only for keys that occur
+    std::vector<int64_t> keys;  // sorted unique keys
+    int64_t dense_edges = 0;
+    double cost;
+};
+
+block_plan plan_blocks(const int64_t *row, const int64_t *col, int64_t num_edges, int64_t neuron_size, int64_t b) {
+    block_plan plan;
+    plan.block_size = b;
+    plan.num_block_cols = (neuron_size + b - 1) / b;
+    int64_t full_blocks = neuron_size / b; // block rows/cols lying entirely inside the matrix
+    plan.key.resize(num_edges);
+    for (int64_t e = 0; e < num_edges; ++e) {
+        int64_t rb = row[e] / b;
+        int64_t cb = col[e] / b;
+        plan.key[e] = (rb < full_blocks && cb < full_blocks) ? rb * plan.num_block_cols + cb : -1;
+    }
+    std::vector<int64_t> sorted = plan.key;
+    std::sort(sorted.begin(), sorted.end());
+    int64_t dense_edges = 0;
+    int64_t dense_blocks = 0;
+    for (size_t s = 0; s < sorted.size();) {
+        size_t t = s;
+        while (t < sorted.size() && sorted[t] == sorted[s])
+            ++t;
+        int64_t n = static_cast<int64_t>(t - s);
+        if (sorted[s] >= 0 && n * DENSE_BLOCK_SPEEDUP >= b * b) {
+            plan.keys.push_back(sorted[s]);
+            plan.count.push_back(n);
+            dense_edges += n;
+            dense_blocks += 1;
+        }
+        s = t;
+    }
+    plan.dense_edges = dense_edges;
+    plan.cost = static_cast<double>(dense_blocks * b * b) / DENSE_BLOCK_SPEEDUP + (num_edges - dense_edges);
+    return plan;
+}
+
+struct matmul_args {
+    const float *x;
+    float *y;
+    const int64_t *brp, *bcol;
+    const float *bval;
+    const int64_t *crp, *ccol;
+    const float *cval;
+    int64_t b, B, neuron_size;
+};
+
+// block rows [begin, end) of Y = W X with the kernels of K
+// always inlined, so the AVX-512 entry point compiles the whole loop for its target
+template <class K>
+__attribute__((always_inline)) inline void matmul_rows(const matmul_args &a, int64_t begin, int64_t end) {
+    int64_t b = a.b;
+    int64_t B = a.B;
+    for (int64_t rb = begin; rb < end; ++rb) {
+        float *y_block = a.y + rb * b * B;
+        for (int64_t k = a.brp[rb]; k < a.brp[rb + 1]; ++k) {
+            const float *v = a.bval + k * b * b;
+            const float *x_block = a.x + a.bcol[k] * b * B;
+            switch (b) {
+            case 4:
+                K::template block<4>(B, v, x_block, y_block);
+                break;
+            case 8:
+                K::template block<8>(B, v, x_block, y_block);
+                break;
+            default:
+                K::template block<16>(B, v, x_block, y_block);
+                break;
+            }
+        }
+        int64_t row_end = std::min(a.neuron_size, (rb + 1) * b);
+        for (int64_t r = rb * b; r < row_end; ++r)
+            for (int64_t e = a.crp[r]; e < a.crp[r + 1]; ++e)
+                K::axpy(B, a.cval[e], a.x + a.ccol[e] * B, a.y + r * B);
+    }
+}
+
+void matmul_rows_scalar(const matmul_args &a, int64_t begin, int64_t end) { matmul_rows<scalar_kernels>(a, begin, end); }
+
+#ifdef RAYBNN_AVX512_KERNELS
+RAYBNN_TARGET_AVX512 void matmul_rows_avx512(const matmul_args &a, int64_t begin, int64_t end) {
+    matmul_rows<avx512_kernels>(a, begin, end);
+}
+#endif
+
+} // namespace
+
+block_sparse block_sparse::build(const Tensor &WRowIdx, const Tensor &WColIdx, const Tensor &WValues, int64_t neuron_size, int64_t block_size) {
+    assert(WRowIdx.size(0) == WColIdx.size(0) && WRowIdx.size(0) == WValues.size(0));
+    assert(block_size == 0 || block_size == 4 || block_size == 8 || block_size == 16);
+    Tensor row = WRowIdx.to(torch::kCPU, torch::kLong).contiguous();
+    Tensor col = WColIdx.to(torch::kCPU, torch::kLong).contiguous();
+    Tensor val = WValues.to(torch::kCPU, torch::kFloat).contiguous();
+    const int64_t *row_ptr = row.data_ptr<int64_t>();
+    const int64_t *col_ptr = col.data_ptr<int64_t>();
+    const float *val_ptr = val.data_ptr<float>();
+    int64_t num_edges = row.size(0);
+
+    block_plan plan;
+    plan.cost = std::numeric_limits<double>::infinity();
+    for (int64_t b : BLOCK_SIZES) {
+        if (block_size != 0 && b != block_size)
+            continue;
+        block_plan candidate = plan_blocks(row_ptr, col_ptr, num_edges, neuron_size, b);
+        if (candidate.cost < plan.cost)
+            plan = std::move(candidate);
+    }
+    int64_t b = plan.block_size;
+
+    block_sparse W;
+    W.neuron_size_ = neuron_size;
+    W.block_size_ = b;
+    W.num_block_edges_ = plan.dense_edges;
+    int64_t num_block_rows = (neuron_size + b - 1) / b;
+    int64_t num_blocks = static_cast<int64_t>(plan.keys.size());
+    auto long_opts = torch::TensorOptions().dtype(torch::kLong);
+
+    W.block_row_ptr_ = torch::zeros({num_block_rows + 1}, long_opts);
+    W.block_col_ = torch::empty({num_blocks}, long_opts);
+    W.block_values_ = torch::zeros({num_blocks, b, b}, torch::TensorOptions().dtype(torch::kFloat));
+    int64_t *brp = W.block_row_ptr_.data_ptr<int64_t>();
+    int64_t *bcol = W.block_col_.data_ptr<int64_t>();
+    float *bval = W.block_values_.data_ptr<float>();
+    for (int64_t k = 0; k < num_blocks; ++k) {
+        brp[plan.keys[k] / plan.num_block_cols + 1] += 1;
+        bcol[k] = plan.keys[k] % plan.num_block_cols;
+    }
+    for (int64_t r = 0; r < num_block_rows; ++r)
+        brp[r + 1] += brp[r];
+
+    // scattered edges in (row, col) order
+    std::vector<int64_t> scattered;
+    for (int64_t e = 0; e < num_edges; ++e) {
+        auto it = std::lower_bound(plan.keys.begin(), plan.keys.end(), plan.key[e]);
+        if (plan.key[e] >= 0 && it != plan.keys.end() && *it == plan.key[e]) {
+            int64_t k = it - plan.keys.begin();
+            bval[(k * b + row_ptr[e] % b) * b + col_ptr[e] % b] += val_ptr[e];
+        } else {
+            scattered.push_back(e);
+        }
+    }
+    std::sort(scattered.begin(), scattered.end(), [&](int64_t x, int64_t y) {
+        return row_ptr[x] < row_ptr[y] || (row_ptr[x] == row_ptr[y] && col_ptr[x] < col_ptr[y]);
+    });
+    int64_t num_scattered = static_cast<int64_t>(scattered.size());
+    W.csr_row_ptr_ = torch::zeros({neuron_size + 1}, long_opts);
+    W.csr_col_ = torch::empty({num_scattered}, long_opts);
+    W.csr_values_ = torch::empty({num_scattered}, torch::TensorOptions().dtype(torch::kFloat));
+    int64_t *crp = W.csr_row_ptr_.data_ptr<int64_t>();
+    int64_t *ccol = W.csr_col_.data_ptr<int64_t>();
+    float *cval = W.csr_values_.data_ptr<float>();
+    for (int64_t s = 0; s < num_scattered; ++s) {
+        int64_t e = scattered[s];
+        crp[row_ptr[e] + 1] += 1;
+        ccol[s] = col_ptr[e];
+        cval[s] = val_ptr[e];
+    }
+    for (int64_t r = 0; r < neuron_size; ++r)
+        crp[r + 1] += crp[r];
+    return W;
+}
+
+// X [neuron_size, B], block rows are independent so they are split across the intra-op threads
+Tensor block_sparse::matmul(const Tensor &X) const {
+    assert(defined());
+    assert(X.dim() == 2 && X.size(0) == neuron_size_);
+    Tensor Xc = X.to(torch::kCPU, torch::kFloat).contiguous();
+    int64_t B = Xc.size(1);
+    Tensor Y = torch::zeros({neuron_size_, B}, Xc.options());
+    const float *x = Xc.data_ptr<float>();
+    float *y = Y.data_ptr<float>();
+    const int64_t *brp = block_row_ptr_.data_ptr<int64_t>();
+    const int64_t *bcol = block_col_.data_ptr<int64_t>();
+    const float *bval = block_values_.data_ptr<float>();
+    const int64_t *crp = csr_row_ptr_.data_ptr<int64_t>();
+    const int64_t *ccol = csr_col_.data_ptr<int64_t>();
+    const float *cval = csr_values_.data_ptr<float>();
+    int64_t num_block_rows = block_row_ptr_.size(0) - 1;
+
+    matmul_args args{x, y, brp, bcol, bval, crp, ccol, cval, block_size_, B, neuron_size_};
+    void (*rows)(const matmul_args &, int64_t, int64_t) = matmul_rows_scalar;
+#ifdef RAYBNN_AVX512_KERNELS
+    if (cpu_has_avx512())
+        rows = matmul_rows_avx512;
+#endif
+    at::parallel_for(0, num_block_rows, 1, [&](int64_t begin, int64_t end) { rows(args, begin, end); });
+    return Y.to(X.device());
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <torch/torch.h>
+
+// Block-sparse weight matrix for the recurrent product Y = W X
+// Edges inside well-filled b x b blocks are stored as dense blocks (BSR), the remaining scattered edges as CSR.
+// Raw RayBNN numbering follows placement order, so network::prepare first renumbers the neurons with
+// sparse::reverse_cuthill_mckee; local connectivity then puts most edges in blocks near the diagonal,
+// where the dense micro-kernel runs SIMD multiply-adds instead of one gather per edge.
+class block_sparse {
+public:
+    static constexpr int64_t BLOCK_SIZES[] = {4, 8, 16};
+
+    block_sparse() = default;
+
+    // WRowIdx [E] (receivers), WColIdx [E] (senders), WValues [E] float; duplicate edges are summed
+    // block_size 0 picks the size from BLOCK_SIZES with the lowest estimated cost
+    static block_sparse build(const torch::Tensor &WRowIdx,
+                              const torch::Tensor &WColIdx,
+                              const torch::Tensor &WValues,
+                              int64_t neuron_size,
+                              int64_t block_size = 0);
+
+    // X [neuron_size, B] float on CPU, output [neuron_size, B]
+    torch::Tensor matmul(const torch::Tensor &X) const;
+
+    int64_t block_size() const { return block_size_; }
+    int64_t num_blocks() const { return block_col_.size(0); }
+    int64_t num_scattered() const { return csr_col_.size(0); }
+    // edges stored in dense blocks, and their share of the block elements
+    int64_t num_block_edges() const { return num_block_edges_; }
+    double block_fill() const {
+        int64_t elements = num_blocks() * block_size_ * block_size_;
+        return elements > 0 ? static_cast<double>(num_block_edges_) / elements : 0.0;
+    }
+    bool defined() const { return neuron_size_ > 0; }
+
+private:
+    int64_t neuron_size_ = 0;
+    int64_t block_size_ = 0;
+    int64_t num_block_edges_ = 0;
+    torch::Tensor block_row_ptr_; // [num_block_rows + 1]
+    torch::Tensor block_col_;     // [num_blocks]
+    torch::Tensor block_values_;  // [num_blocks, b, b] row-major
+    torch::Tensor csr_row_ptr_;   // [neuron_size + 1]
+    torch::Tensor csr_col_;       // [num_scattered]
+    torch::Tensor csr_values_;    // [num_scattered]
+};
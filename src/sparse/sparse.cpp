@@ -1,54 +1,40 @@
 #include "sparse.hpp"
 #include <ATen/core/TensorBody.h>
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <vector>
 
 using namespace torch;
 
-// find the element and output its index
+// find the elements of WRowIdxCOO that occur in target_rows and output their indices
 //  WRowIdxCOO [M]
 //  target_rows [N]
+// Output idx [K] into WRowIdxCOO, ascending
 torch::Tensor sparse::COO_find(const torch::Tensor &WRowIdxCOO, const torch::Tensor &target_rows) {
     // TORCH_CHECK(WRowIdxCOO.device() == target_rows.device(), "Device mismatch");
-    // TORCH_CHECK(WRowIdxCOO.dtype() == target_rows.dtype(), "Dtype mismatch");
 
-    Tensor target_rows_unsq = target_rows.unsqueeze(1);      // [N, 1]
-    Tensor WRowIdxCOO_unsq = WRowIdxCOO.unsqueeze(0);        // [1, M]
-    Tensor eq_result = target_rows_unsq.eq(WRowIdxCOO_unsq); // [N, M] bool
+    Tensor WRowIdxCOO_unsq = WRowIdxCOO.reshape({-1, 1});       // [M, 1]
+    Tensor target_rows_unsq = target_rows.reshape({1, -1});     // [1, N]
+    Tensor eq_result = WRowIdxCOO_unsq.eq(target_rows_unsq);    // [M, N] bool
 
-    Tensor any_result = eq_result.any(1); // [N] bool
+    Tensor any_result = eq_result.any(1); // [M] bool
 
-    return any_result;
+    return torch::nonzero(any_result).squeeze(1);
 }
 
+// Same as COO_find, target_rows is processed batch_size elements at a time to bound the [M, batch_size] comparison
 Tensor sparse::COO_find_batch(const Tensor &WRowIdxCOO, const Tensor &target_rows, int64_t batch_size) {
-    int64_t total_size = target_rows.size(0);
-    int64_t i = 0;
-    std::vector<Tensor> idx_list;
+    int64_t total_size = target_rows.numel();
+    Tensor flat_targets = target_rows.reshape({-1});
+    Tensor found = torch::zeros({WRowIdxCOO.numel()}, torch::TensorOptions().dtype(torch::kBool).device(WRowIdxCOO.device()));
 
-    while (i < total_size) {
-        int64_t startseq = i;
-        int64_t endseq = std::min(i + batch_size - 1, total_size - 1);
-
-        Tensor inputarr = target_rows.slice(0, startseq, endseq + 1);
-
-        Tensor idx = sparse::COO_find(WRowIdxCOO, inputarr);
-
-        Tensor valid_idx = idx.masked_select(idx >= 0);
-        if (valid_idx.size(0) > 0) {
-            idx_list.push_back(valid_idx);
-        }
-
-        i += batch_size;
-    }
-
-    Tensor total_idx;
-    if (!idx_list.empty()) {
-        total_idx = torch::cat(idx_list, 0);
-        total_idx = std::get<0>(torch::sort(total_idx, /*dim=*/0, /*descending=*/true));
-    } else {
-        total_idx = torch::empty({0}, torch::kInt64);
+    for (int64_t i = 0; i < total_size; i += batch_size) {
+        Tensor inputarr = flat_targets.slice(0, i, std::min(i + batch_size, total_size));
+        found.index_fill_(0, sparse::COO_find(WRowIdxCOO, inputarr), true);
     }
 
-    return total_idx;
+    return torch::nonzero(found).squeeze(1);
 }
 
 // arr [M], ranging from 0 to neuron_size
@@ -58,7 +44,129 @@ torch::Tensor sparse::find_unique(const torch::Tensor &arr, int64_t neuron_size)
 
     table.index_put_({arr}, true);
 
-    auto unique_idx = torch::nonzero(table).squeeze();
+    auto unique_idx = torch::nonzero(table).squeeze(1); // stays 1-D for a single element
 
     return unique_idx;
 }
+
+// Reverse Cuthill-McKee ordering of the symmetrised connectivity graph
+// WRowIdx [E], WColIdx [E], ranging from 0 to neuron_size
+// output perm [neuron_size], perm[new_idx] = old_idx
+// Neurons 0..fixed_head and the last fixed_tail neurons (input and output neurons) keep their index,
+// only the neurons in between are reordered.
+// Each connected component is started from a minimum degree neuron, isolated neurons end up last.
+torch::Tensor sparse::reverse_cuthill_mckee(const torch::Tensor &WRowIdx,
+                                            const torch::Tensor &WColIdx,
+                                            int64_t neuron_size,
+                                            int64_t fixed_head,
+                                            int64_t fixed_tail) {
+    assert(WRowIdx.size(0) == WColIdx.size(0));
+    assert(fixed_head >= 0 && fixed_tail >= 0 && fixed_head + fixed_tail <= neuron_size);
+    Tensor row = WRowIdx.to(torch::kCPU, torch::kLong).contiguous();
+    Tensor col = WColIdx.to(torch::kCPU, torch::kLong).contiguous();
+    const int64_t *row_ptr = row.data_ptr<int64_t>();
+    const int64_t *col_ptr = col.data_ptr<int64_t>();
+    int64_t num_edges = row.size(0);
+
+    // undirected CSR without self loops
+    std::vector<int64_t> degree(neuron_size, 0);
+    for (int64_t e = 0; e < num_edges; ++e) {
+        if (row_ptr[e] == col_ptr[e])
+            continue;
+        degree[row_ptr[e]]++;
+        degree[col_ptr[e]]++;
+    }
+    std::vector<int64_t> offset(neuron_size + 1, 0);
+    for (int64_t i = 0; i < neuron_size; ++i)
+        offset[i + 1] = offset[i] + degree[i];
+    std::vector<int64_t> adj(offset[neuron_size]);
+    std::vector<int64_t> fill(offset.begin(), offset.end() - 1);
+    for (int64_t e = 0; e < num_edges; ++e) {
+        if (row_ptr[e] == col_ptr[e])
+            continue;
+        adj[fill[row_ptr[e]]++] = col_ptr[e];
+        adj[fill[col_ptr[e]]++] = row_ptr[e];
+    }
+
+    // visit neighbours in increasing degree, duplicate edges are skipped by the visited check
+    auto by_degree = [&](int64_t a, int64_t b) { return degree[a] < degree[b] || (degree[a] == degree[b] && a < b); };
+    for (int64_t i = 0; i < neuron_size; ++i)
+        std::sort(adj.begin() + offset[i], adj.begin() + offset[i + 1], by_degree);
+
+    int64_t interior_end = neuron_size - fixed_tail;
+    std::vector<int64_t> start_order(interior_end - fixed_head);
+    std::iota(start_order.begin(), start_order.end(), fixed_head);
+    std::stable_sort(start_order.begin(), start_order.end(), by_degree);
+
+    // fixed neurons count towards the degrees but are never visited
+    std::vector<int64_t> order;
+    order.reserve(neuron_size);
+    std::vector<bool> visited(neuron_size, false);
+    std::fill(visited.begin(), visited.begin() + fixed_head, true);
+    std::fill(visited.begin() + interior_end, visited.end(), true);
+    for (int64_t start : start_order) {
+        if (visited[start])
+            continue;
+        visited[start] = true;
+        size_t head = order.size();
+        order.push_back(start);
+        while (head < order.size()) {
+            int64_t cur = order[head++];
+            for (int64_t k = offset[cur]; k < offset[cur + 1]; ++k) {
+                int64_t next = adj[k];
+                if (!visited[next]) {
+                    visited[next] = true;
+                    order.push_back(next);
+                }
+            }
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<int64_t> perm(neuron_size);
+    std::iota(perm.begin(), perm.begin() + fixed_head, 0);
+    std::copy(order.begin(), order.end(), perm.begin() + fixed_head);
+    std::iota(perm.begin() + interior_end, perm.end(), interior_end);
+
+    return torch::tensor(perm, torch::dtype(torch::kLong)).to(WRowIdx.device());
+}
+
+// perm [N], output inv [N] with inv[perm[i]] = i
+torch::Tensor sparse::inverse_permutation(const torch::Tensor &perm) {
+    Tensor inv = torch::empty_like(perm);
+    inv.index_put_({perm}, torch::arange(perm.size(0), perm.options()));
+    return inv;
+}
+
+// Renumber neurons with perm (perm[new_idx] = old_idx) and keep the edges sorted by (row, col)
+// cell_pos [N, 3], WRowIdx [E], WColIdx [E], WValues [E] or undefined if there are no weights yet
+void sparse::apply_permutation(const torch::Tensor &perm,
+                               torch::Tensor &cell_pos,
+                               torch::Tensor &WRowIdx,
+                               torch::Tensor &WColIdx,
+                               torch::Tensor &WValues) {
+    assert(perm.size(0) == cell_pos.size(0));
+    assert(WRowIdx.size(0) == WColIdx.size(0));
+    Tensor perm_idx = perm.to(cell_pos.device(), torch::kLong);
+    cell_pos = cell_pos.index_select(0, perm_idx);
+
+    Tensor inv = inverse_permutation(perm_idx).to(WRowIdx.device());
+    Tensor new_row = inv.index_select(0, WRowIdx.to(torch::kLong));
+    Tensor new_col = inv.index_select(0, WColIdx.to(torch::kLong));
+
+    Tensor key = new_row * perm.size(0) + new_col;
+    Tensor sort_idx = std::get<1>(key.sort());
+    WRowIdx = new_row.index_select(0, sort_idx).to(WRowIdx.scalar_type());
+    WColIdx = new_col.index_select(0, sort_idx).to(WColIdx.scalar_type());
+    if (WValues.defined()) {
+        assert(WValues.size(0) == sort_idx.size(0));
+        WValues = WValues.index_select(0, sort_idx.to(WValues.device()));
+    }
+}
+
+// max |row - col| over all edges
+int64_t sparse::bandwidth(const torch::Tensor &WRowIdx, const torch::Tensor &WColIdx) {
+    if (WRowIdx.size(0) == 0)
+        return 0;
+    return (WRowIdx.to(torch::kLong) - WColIdx.to(torch::kLong)).abs().max().item<int64_t>();
+}
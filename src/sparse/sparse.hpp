@@ -1,3 +1,5 @@
+#pragma once
+
 #include <ATen/core/TensorBody.h>
 #include <torch/torch.h>
 
@@ -6,4 +8,17 @@ public:
     static torch::Tensor COO_find(const torch::Tensor &WRowIdxCOO, const torch::Tensor &target_rows);
     static torch::Tensor COO_find_batch(const torch::Tensor &WRowIdxCOO, const torch::Tensor &target_rows, int64_t batch_size);
     static torch::Tensor find_unique(const torch::Tensor &arr, int64_t neuron_size);
+
+    static torch::Tensor reverse_cuthill_mckee(const torch::Tensor &WRowIdx,
+                                               const torch::Tensor &WColIdx,
+                                               int64_t neuron_size,
+                                               int64_t fixed_head = 0,
+                                               int64_t fixed_tail = 0);
+    static torch::Tensor inverse_permutation(const torch::Tensor &perm);
+    static void apply_permutation(const torch::Tensor &perm,
+                                  torch::Tensor &cell_pos,
+                                  torch::Tensor &WRowIdx,
+                                  torch::Tensor &WColIdx,
+                                  torch::Tensor &WValues);
+    static int64_t bandwidth(const torch::Tensor &WRowIdx, const torch::Tensor &WColIdx);
 };
@@ -0,0 +1,163 @@
+#include "memory_tracker.hpp"
+#include <algorithm>
+#include <c10/core/Allocator.h>
+#include <c10/core/CPUAllocator.h>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <torch/version.h>
+#include <unordered_map>
+
+#if TORCH_VERSION_MAJOR > 2 || (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 3)
+#define RAYBNN_ALLOCATOR_CONST
+#else
+#define RAYBNN_ALLOCATOR_CONST const
+#endif
+
+constexpr uint8_t TRACKER_PRIORITY = 100; // above the default CPU allocator registration
+
+namespace {
+
+std::mutex stats_mutex;
+std::unordered_map<std::string, memory_tracker::scope_stats> scope_table; // element addresses are stable
+int64_t process_current = 0;
+int64_t process_peak = 0;
+
+thread_local std::vector<memory_tracker::scope_stats *> scope_stack;
+
+memory_tracker::scope_stats *lookup_scope(const char *name) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return &scope_table[name];
+}
+
+// keeps the wrapped DataPtr alive and remembers whom to charge when it is released
+struct tracked_block {
+    c10::DataPtr inner;
+    memory_tracker::scope_stats *scope;
+    int64_t bytes;
+};
+
+void release_block(void *ctx) {
+    auto *block = static_cast<tracked_block *>(ctx);
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        block->scope->current_bytes -= block->bytes;
+        process_current -= block->bytes;
+    }
+    delete block; // frees the memory through the wrapped allocator's deleter
+}
+
+class tracking_allocator final : public c10::Allocator {
+public:
+    c10::Allocator *base = nullptr;
+
+    c10::DataPtr allocate(size_t nbytes) RAYBNN_ALLOCATOR_CONST override {
+        c10::DataPtr inner = base->allocate(nbytes);
+        void *data = inner.get();
+        c10::Device device = inner.device();
+
+        static memory_tracker::scope_stats *unscoped = lookup_scope("unscoped");
+        memory_tracker::scope_stats *scope = scope_stack.empty() ? unscoped : scope_stack.back();
+        int64_t bytes = static_cast<int64_t>(nbytes);
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            process_current += bytes;
+            process_peak = std::max(process_peak, process_current);
+            scope->current_bytes += bytes;
+            scope->allocated_bytes += bytes;
+            scope->allocations += 1;
+            scope->peak_bytes = std::max(scope->peak_bytes, scope->current_bytes);
+            for (memory_tracker::scope_stats *active : scope_stack)
+                active->peak_process_bytes = std::max(active->peak_process_bytes, process_current);
+            if (scope_stack.empty())
+                unscoped->peak_process_bytes = std::max(unscoped->peak_process_bytes, process_current);
+        }
+        auto *block = new tracked_block{std::move(inner), scope, bytes};
+        return c10::DataPtr(data, block, &release_block, device);
+    }
+
+#if TORCH_VERSION_MAJOR > 2 || (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 3)
+    void copy_data(void *dest, const void *src, std::size_t count) const override { default_copy_data(dest, src, count); }
+#endif
+};
+
+tracking_allocator tracker;
+bool tracker_installed = false;
+
+} // namespace
+
+// Must be called before the tensors of interest are allocated; existing tensors stay untracked
+void memory_tracker::install() {
+    if (tracker_installed)
+        return;
+    tracker.base = c10::GetCPUAllocator();
+    c10::SetCPUAllocator(&tracker, TRACKER_PRIORITY);
+    tracker_installed = true;
+}
+
+// Blocks allocated while installed keep reporting to the tracker when they are released
+void memory_tracker::uninstall() {
+    if (!tracker_installed)
+        return;
+    c10::SetCPUAllocator(tracker.base, TRACKER_PRIORITY);
+    tracker_installed = false;
+}
+
+bool memory_tracker::installed() { return tracker_installed; }
+
+// Peaks restart from the current live bytes, e.g. between batches
+void memory_tracker::reset_peaks() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    process_peak = process_current;
+    for (auto &[name, s] : scope_table) {
+        s.peak_bytes = s.current_bytes;
+        s.peak_process_bytes = 0;
+    }
+}
+
+int64_t memory_tracker::current_bytes() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return process_current;
+}
+
+int64_t memory_tracker::peak_bytes() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return process_peak;
+}
+
+memory_tracker::scope_stats memory_tracker::stats(const std::string &scope) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    auto it = scope_table.find(scope);
+    return it == scope_table.end() ? scope_stats{} : it->second;
+}
+
+std::map<std::string, memory_tracker::scope_stats> memory_tracker::all_stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return {scope_table.begin(), scope_table.end()};
+}
+
+std::string memory_tracker::to_json() {
+    std::ostringstream out;
+    out << "{\"current_bytes\": " << current_bytes() << ", \"peak_bytes\": " << peak_bytes() << ", \"scopes\": {";
+    bool first = true;
+    for (const auto &[name, s] : all_stats()) {
+        out << (first ? "" : ", ") << "\"" << name << "\": {\"current_bytes\": " << s.current_bytes << ", \"peak_bytes\": " << s.peak_bytes
+            << ", \"peak_process_bytes\": " << s.peak_process_bytes << ", \"allocated_bytes\": " << s.allocated_bytes
+            << ", \"allocations\": " << s.allocations << "}";
+        first = false;
+    }
+    out << "}}";
+    return out.str();
+}
+
+void memory_tracker::dump_json(const std::string &file_path) {
+    std::ofstream file(file_path);
+    if (!file)
+        throw std::runtime_error("memory_tracker: cannot open " + file_path);
+    file << to_json() << std::endl;
+}
+
+memory_scope::memory_scope(const char *name) { scope_stack.push_back(lookup_scope(name)); }
+
+memory_scope::~memory_scope() { scope_stack.pop_back(); }
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Reporting CPU allocator: wraps the c10 CPU allocator and attributes current and peak bytes to named scopes.
+// Allocations are attributed to the innermost memory_scope of the allocating thread ("unscoped" otherwise);
+// intra-op worker threads allocate rarely and show up as "unscoped".
+class memory_tracker {
+public:
+    struct scope_stats {
+        int64_t current_bytes = 0;      // live bytes allocated inside the scope
+        int64_t peak_bytes = 0;         // maximum of current_bytes
+        int64_t peak_process_bytes = 0; // maximum of all tracked live bytes seen while the scope was allocating
+        int64_t allocated_bytes = 0;    // cumulative
+        int64_t allocations = 0;
+    };
+
+    static void install();
+    static void uninstall();
+    static bool installed();
+    static void reset_peaks();
+
+    static int64_t current_bytes();
+    static int64_t peak_bytes();
+    static scope_stats stats(const std::string &scope);
+    static std::map<std::string, scope_stats> all_stats();
+
+    static std::string to_json();
+    static void dump_json(const std::string &file_path);
+};
+
+// RAII guard naming the allocations of the current thread while it is alive
+class memory_scope {
+public:
+    explicit memory_scope(const char *name);
+    ~memory_scope();
+
+    memory_scope(const memory_scope &) = delete;
+    memory_scope &operator=(const memory_scope &) = delete;
+};
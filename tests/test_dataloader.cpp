@@ -14,3 +14,40 @@ TEST_CASE("load_files_to_vectorr", "[load_files_to_vector]") {
     std::cout << "Features[10]: " << features.index({10}) << std::endl;
     // std::cout << "Labels " << labels.index({torch::indexing::Slice{0, 50}, "..."}) << std::endl;
 }
+
+TEST_CASE("batch_pipeline visits every sample once per epoch", "[batch_pipeline]") {
+    torch::Tensor features = torch::arange(50, torch::dtype(torch::kFloat32)).view({25, 2});
+    torch::Tensor labels = torch::arange(25, torch::dtype(torch::kLong));
+
+    batch_pipeline pipeline(features, labels, 8, 2, 2, true, 42);
+    REQUIRE(pipeline.batches_per_epoch() == 4);
+
+    for (int epoch = 0; epoch < 2; ++epoch) {
+        torch::Tensor seen = torch::zeros({25}, torch::dtype(torch::kLong));
+        torch::Tensor x, y;
+        int64_t batches = 0;
+        while (pipeline.next(x, y)) {
+            REQUIRE(x.size(0) == y.size(0));
+            REQUIRE(torch::equal(x.select(1, 0), (y * 2).to(torch::kFloat32)));
+            seen.index_add_(0, y, torch::ones_like(y));
+            ++batches;
+        }
+        REQUIRE(batches == 4);
+        REQUIRE((seen == 1).all().item<bool>());
+    }
+    torch::Tensor x, y;
+    REQUIRE_FALSE(pipeline.next(x, y));
+}
+
+TEST_CASE("batch_pipeline waits for the consumer on an empty dataset", "[batch_pipeline]") {
+    // many more epochs than the queues hold, every end marker needs a free slot
+    torch::Tensor features = torch::empty({0, 2}, torch::dtype(torch::kFloat32));
+    torch::Tensor labels = torch::empty({0}, torch::dtype(torch::kLong));
+
+    batch_pipeline pipeline(features, labels, 4, 1, 50, true, 1);
+    REQUIRE(pipeline.batches_per_epoch() == 0);
+    torch::Tensor x, y;
+    for (int epoch = 0; epoch < 50; ++epoch)
+        REQUIRE_FALSE(pipeline.next(x, y));
+    REQUIRE_FALSE(pipeline.next(x, y));
+}
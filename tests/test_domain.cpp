@@ -0,0 +1,61 @@
+#include "cells/cells.hpp"
+#include "domain/domain.hpp"
+#include <catch2/catch_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("partition owns every sender once", "[partition]") {
+    cells c;
+    torch::Tensor sender_pos = c.ball_random(200, 5.0f);
+    torch::Tensor receiver_pos = c.ball_random(300, 5.0f);
+    torch::Tensor glia_pos = c.ball_random(100, 5.0f);
+
+    auto parts = domain::partition(4, 1.0f, glia_pos, sender_pos, receiver_pos);
+    REQUIRE(parts.size() == 4);
+
+    torch::Tensor owned = torch::cat({parts[0].sender_idx, parts[1].sender_idx, parts[2].sender_idx, parts[3].sender_idx}, 0);
+    REQUIRE(owned.size(0) == 200);
+    REQUIRE(std::get<0>(torch::_unique(owned, true, false)).size(0) == 200);
+}
+
+TEST_CASE("multi-process raytrace returns valid edges", "[raytrace_distance_limited]") {
+    cells c;
+    modeldata model_info{};
+    model_info.ray_max_rounds = 50;
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 2.0f;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 5.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 5.0f);
+
+    auto [WRowIdx, WColIdx] = domain::raytrace_distance_limited(2, 1, model_info, glia_pos, hidden_pos, hidden_pos);
+    REQUIRE(WRowIdx.size(0) == WColIdx.size(0));
+    REQUIRE(WRowIdx.size(0) > 0);
+
+    torch::Tensor diff = hidden_pos.index_select(0, WRowIdx) - hidden_pos.index_select(0, WColIdx);
+    REQUIRE((diff.pow(2).sum(1) < model_info.con_rad * model_info.con_rad).all().item<bool>());
+
+    torch::Tensor hash = WRowIdx * hidden_pos.size(0) + WColIdx;
+    REQUIRE(std::get<0>(torch::_unique(hash, true, false)).size(0) == hash.size(0));
+}
+
+TEST_CASE("multi-process raytrace matches the single-process coverage schedule", "[raytrace_distance_limited]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 2.0f;
+    model_info.ray_coverage_schedule = true;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 5.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 5.0f);
+
+    // the halo gives every worker all receivers and occluders of its rays, so the merge is exact
+    auto [ref_row, ref_col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos);
+    for (int64_t workers : {1, 3}) {
+        auto [WRowIdx, WColIdx] = domain::raytrace_distance_limited(workers, 1, model_info, glia_pos, hidden_pos, hidden_pos);
+        REQUIRE(torch::equal(WRowIdx, ref_row));
+        REQUIRE(torch::equal(WColIdx, ref_col));
+    }
+}
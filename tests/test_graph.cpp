@@ -0,0 +1,53 @@
+#include "graph/graph.hpp"
+#include "sparse/sparse.hpp"
+#include <catch2/catch_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("delete_loops removes edges between the outputs", "[delete_loops]") {
+    // 0 input -> 1 hidden -> 2, 3 outputs, and 2 -> 3 which closes a loop back into the outputs
+    for (auto dtype : {torch::kLong, torch::kInt}) {
+        torch::Tensor WRowIdx = torch::tensor({1, 2, 3, 3}, torch::dtype(dtype));
+        torch::Tensor WColIdx = torch::tensor({0, 1, 1, 2}, torch::dtype(dtype));
+        torch::Tensor WValues = torch::tensor({0.1f, 0.2f, 0.3f, 0.4f});
+        torch::Tensor last_idx = torch::tensor({2, 3}, torch::dtype(torch::kLong));
+        torch::Tensor first_idx = torch::tensor({0}, torch::dtype(torch::kLong));
+
+        RayBNNGraph graph(WRowIdx, WColIdx);
+        graph.delete_loops(last_idx, first_idx, 4, 1, WValues, WRowIdx, WColIdx);
+
+        // only 3 <- 2 is deleted, outputs keep the [E,1] shape and the input dtypes
+        REQUIRE(WRowIdx.sizes() == torch::IntArrayRef({3, 1}));
+        REQUIRE(WColIdx.sizes() == torch::IntArrayRef({3, 1}));
+        REQUIRE(WValues.sizes() == torch::IntArrayRef({3, 1}));
+        REQUIRE(WRowIdx.scalar_type() == dtype);
+        REQUIRE(WColIdx.scalar_type() == dtype);
+        REQUIRE(WValues.scalar_type() == torch::kFloat);
+        REQUIRE(torch::equal(WRowIdx.view({-1}), torch::tensor({1, 2, 3}, torch::dtype(dtype))));
+        REQUIRE(torch::equal(WColIdx.view({-1}), torch::tensor({0, 1, 1}, torch::dtype(dtype))));
+        REQUIRE(torch::equal(WValues.view({-1}), torch::tensor({0.1f, 0.2f, 0.3f})));
+    }
+}
+
+TEST_CASE("delete_loops keeps a feed-forward graph", "[delete_loops]") {
+    torch::Tensor WRowIdx = torch::tensor({1, 2, 3}, torch::dtype(torch::kLong));
+    torch::Tensor WColIdx = torch::tensor({0, 1, 1}, torch::dtype(torch::kLong));
+    torch::Tensor WValues = torch::tensor({0.1f, 0.2f, 0.3f});
+
+    RayBNNGraph graph(WRowIdx, WColIdx);
+    graph.delete_loops(torch::tensor({2, 3}, torch::dtype(torch::kLong)), torch::tensor({0}, torch::dtype(torch::kLong)), 4, 2, WValues, WRowIdx, WColIdx);
+
+    REQUIRE(torch::equal(WRowIdx.view({-1}), torch::tensor({1, 2, 3}, torch::dtype(torch::kLong))));
+    REQUIRE(torch::equal(WColIdx.view({-1}), torch::tensor({0, 1, 1}, torch::dtype(torch::kLong))));
+}
+
+TEST_CASE("COO_find_batch returns indices into the searched array", "[COO_find_batch]") {
+    torch::Tensor arr = torch::tensor({5, 1, 7, 1, 3}, torch::dtype(torch::kLong));
+    torch::Tensor targets = torch::tensor({1, 3, 9}, torch::dtype(torch::kLong));
+    // batches of one target give the same union as a single batch
+    for (int64_t batch : {1, 2, 8}) {
+        torch::Tensor idx = sparse::COO_find_batch(arr, targets, batch);
+        REQUIRE(torch::equal(idx, torch::tensor({1, 3, 4}, torch::dtype(torch::kLong))));
+    }
+    // a single match stays 1-D
+    REQUIRE(sparse::find_unique(torch::tensor({2}, torch::dtype(torch::kLong)), 4).dim() == 1);
+}
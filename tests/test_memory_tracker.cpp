@@ -0,0 +1,37 @@
+#include "utility/memory_tracker.hpp"
+#include <catch2/catch_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <torch/torch.h>
+
+TEST_CASE("memory_tracker attributes allocations to the innermost scope", "[memory_tracker]") {
+    memory_tracker::install();
+    memory_tracker::reset_peaks();
+    const int64_t bytes = 1 << 20;
+
+    int64_t before = memory_tracker::stats("test_outer").current_bytes;
+    {
+        memory_scope outer("test_outer");
+        torch::Tensor a = torch::empty({bytes}, torch::dtype(torch::kUInt8));
+        {
+            memory_scope inner("test_inner");
+            torch::Tensor b = torch::empty({2 * bytes}, torch::dtype(torch::kUInt8));
+            REQUIRE(memory_tracker::stats("test_inner").current_bytes >= 2 * bytes);
+        }
+        // b was charged to the inner scope and is released again
+        REQUIRE(memory_tracker::stats("test_inner").current_bytes == 0);
+        REQUIRE(memory_tracker::stats("test_outer").current_bytes - before >= bytes);
+    }
+
+    auto outer = memory_tracker::stats("test_outer");
+    auto inner = memory_tracker::stats("test_inner");
+    REQUIRE(outer.current_bytes == before);
+    REQUIRE(outer.peak_bytes >= bytes);
+    REQUIRE(inner.peak_bytes >= 2 * bytes);
+    REQUIRE(inner.peak_process_bytes >= 3 * bytes);
+    REQUIRE(memory_tracker::peak_bytes() >= 3 * bytes);
+
+    std::string json = memory_tracker::to_json();
+    REQUIRE(json.find("\"test_inner\"") != std::string::npos);
+    REQUIRE(json.find("\"peak_bytes\"") != std::string::npos);
+    memory_tracker::uninstall();
+}
@@ -1,4 +1,7 @@
+#include "cells/cells.hpp"
+#include "raytrace/edge_store.hpp"
 #include "raytrace/raytrace.hpp"
+#include "utility/memory_tracker.hpp"
 #include <catch2/catch_all.hpp>
 #include <catch2/catch_test_macros.hpp>
 
@@ -21,3 +24,359 @@ TEST_CASE("dedup_and_sort", "[dedup_and_sort]") {
     std::cout << "WRowIdx: " << WRowIdx << std::endl;
     std::cout << "WColIdx: " << WColIdx << std::endl;
 }
+
+TEST_CASE("incremental insert matches rebuild", "[raytrace_incremental]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+
+    torch::Tensor hidden_pos = c.ball_random(160, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(40, 4.0f);
+    torch::Tensor old_pos = hidden_pos.slice(0, 0, 150);
+    torch::Tensor empty = torch::empty({0}, torch::dtype(torch::kLong));
+
+    auto [old_row, old_col] = tracer.raytrace_incremental(model_info, glia_pos, old_pos, old_pos, empty, empty, torch::arange(150));
+    auto [full_row, full_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, empty, empty, torch::arange(160));
+    auto [inc_row, inc_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, old_row, old_col, torch::arange(150, 160));
+
+    REQUIRE(torch::equal(inc_row, full_row));
+    REQUIRE(torch::equal(inc_col, full_col));
+    // a workspace carried over from an unrelated call gives the same edges
+    raytrace_workspace ws;
+    tracer.raytrace_incremental(ws, model_info, glia_pos, old_pos, old_pos, empty, empty, torch::arange(150));
+    auto [ws_row, ws_col] =
+        tracer.raytrace_incremental(ws, model_info, glia_pos, hidden_pos, hidden_pos, old_row, old_col, torch::arange(150, 160));
+    REQUIRE(torch::equal(ws_row, full_row));
+    REQUIRE(torch::equal(ws_col, full_col));
+    // and both match a from-scratch build that traces every candidate ray once
+    modeldata coverage_info = model_info;
+    coverage_info.ray_coverage_schedule = true;
+    auto [scratch_row, scratch_col] = tracer.raytrace_distance_limited(coverage_info, glia_pos, hidden_pos, hidden_pos);
+    REQUIRE(torch::equal(inc_row, scratch_row));
+    REQUIRE(torch::equal(inc_col, scratch_col));
+
+    torch::Tensor removed = torch::tensor({3, 77}, torch::dtype(torch::kLong));
+    torch::Tensor alive = torch::ones({160}, torch::dtype(torch::kBool));
+    alive.index_put_({removed}, false);
+    auto [rm_row, rm_col] = tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, full_row, full_col, empty, removed);
+    auto [ref_row, ref_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, empty, empty, alive.nonzero().squeeze(1), removed);
+
+    REQUIRE(torch::equal(rm_row, ref_row));
+    REQUIRE(torch::equal(rm_col, ref_col));
+    // removed neurons are gone from hidden_pos in the from-scratch build, renumber to compare
+    torch::Tensor alive_idx = alive.nonzero().squeeze(1);
+    auto [kept_row, kept_col] = tracer.raytrace_distance_limited(coverage_info, glia_pos, hidden_pos.index_select(0, alive_idx),
+                                                                 hidden_pos.index_select(0, alive_idx));
+    REQUIRE(torch::equal(rm_row, alive_idx.index_select(0, kept_row)));
+    REQUIRE(torch::equal(rm_col, alive_idx.index_select(0, kept_col)));
+}
+
+TEST_CASE("workspace variants match allocating versions", "[raytrace_workspace]") {
+    raytrace_workspace ws;
+    torch::Tensor pos = torch::rand({64, 3}) * 4.0f;
+    torch::Tensor idx = torch::arange(64, torch::dtype(torch::kLong));
+    torch::Tensor center = pos.slice(0, 0, 1);
+
+    auto [ref_pos, ref_idx] = raytrace::filter_rays(2.0f, center, pos, idx);
+    torch::Tensor out_pos, out_idx;
+    raytrace::filter_rays_out(2.0f, center, pos, idx, ws, out_pos, out_idx);
+    REQUIRE(torch::equal(ref_pos, out_pos));
+    REQUIRE(torch::equal(ref_idx, out_idx));
+
+    torch::Tensor line_start = torch::rand({40, 3});
+    torch::Tensor line_end = torch::rand({40, 3}) + 0.5f;
+    torch::Tensor radius = torch::full({64}, 0.3f);
+    torch::Tensor mask;
+    // run twice so the second call goes through already grown buffers
+    for (int i = 0; i < 2; ++i) {
+        raytrace::line_sphere_intersect_out(line_start, line_end, pos * 0.5f, radius, ws, mask);
+        REQUIRE(torch::equal(mask, raytrace::line_sphere_intersect(line_start, line_end, pos * 0.5f, radius)));
+    }
+
+    torch::Tensor WRowIdx = torch::tensor({0, 9, 0, 1, 2, 0, 1, 2}, torch::dtype(torch::kLong));
+    torch::Tensor WColIdx = torch::tensor({9, 9, 1, 2, 3, 1, 2, 3}, torch::dtype(torch::kLong));
+    torch::Tensor out_row, out_col;
+    raytrace::dedup_and_sort_out(WRowIdx, WColIdx, ws, out_row, out_col);
+    raytrace::dedup_and_sort(WRowIdx, WColIdx);
+    REQUIRE(torch::equal(out_row, WRowIdx));
+    REQUIRE(torch::equal(out_col, WColIdx));
+}
+
+TEST_CASE("a warm workspace traces rounds without allocating", "[raytrace_workspace]") {
+    cells c;
+    raytrace tracer;
+    raytrace_workspace ws;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+    model_info.ray_coverage_schedule = true;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 4.0f);
+    const std::vector<std::string> round_scopes = {"filter", "occluder_cull", "pair_generation", "neuron_occlusion", "glia_occlusion"};
+
+    memory_tracker::install();
+    // the coverage schedule replays the same tiles, so the first call grows every buffer to its final size
+    auto [row, col] = tracer.raytrace_distance_limited(ws, model_info, glia_pos, hidden_pos, hidden_pos);
+    std::map<std::string, int64_t> cold;
+    for (const std::string &scope : round_scopes)
+        cold[scope] = memory_tracker::stats(scope).allocated_bytes;
+    REQUIRE(cold["pair_generation"] > 0);
+
+    auto [warm_row, warm_col] = tracer.raytrace_distance_limited(ws, model_info, glia_pos, hidden_pos, hidden_pos);
+    for (const std::string &scope : round_scopes) {
+        INFO(scope);
+        REQUIRE(memory_tracker::stats(scope).allocated_bytes == cold[scope]);
+    }
+    memory_tracker::uninstall();
+    REQUIRE(torch::equal(row, warm_row));
+    REQUIRE(torch::equal(col, warm_col));
+}
+
+TEST_CASE("coverage schedule finds every edge", "[raytrace_distance_limited]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+    model_info.ray_coverage_schedule = true;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 4.0f);
+    torch::Tensor empty = torch::empty({0}, torch::dtype(torch::kLong));
+
+    auto [row, col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos);
+    // seeding every neuron makes the incremental path an exhaustive reference
+    auto [ref_row, ref_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, empty, empty, torch::arange(200));
+    REQUIRE(torch::equal(row, ref_row));
+    REQUIRE(torch::equal(col, ref_col));
+}
+
+TEST_CASE("mixed precision occlusion matches float32", "[line_sphere_intersect_mixed]") {
+    torch::manual_seed(7);
+    torch::Tensor line_start = torch::rand({300, 3}) * 3.0f;
+    torch::Tensor line_end = line_start + (torch::rand({300, 3}) - 0.5f) * 2.0f;
+    line_end[0] = line_start[0]; // degenerate ray
+    torch::Tensor block_cells = torch::rand({500, 3}) * 6.0f - 1.5f;
+    block_cells[1] = torch::tensor({100.0f, -100.0f, 50.0f}); // far outside the bundle
+    torch::Tensor block_radius = torch::full({500}, 0.2f);
+
+    torch::Tensor ref = raytrace::line_sphere_intersect(line_start, line_end, block_cells, block_radius);
+    torch::Tensor mixed = raytrace::line_sphere_intersect_mixed(line_start, line_end, block_cells, block_radius);
+    REQUIRE(ref.any().item<bool>());
+    REQUIRE(torch::equal(ref, mixed));
+}
+
+TEST_CASE("mixed precision workspace variant matches float32", "[line_sphere_intersect_mixed]") {
+    torch::manual_seed(3);
+    raytrace_workspace ws;
+    torch::Tensor mask;
+    // the second and third calls reuse buffers grown by the first, with fewer rays and occluders
+    for (int64_t n : {400, 250, 250}) {
+        torch::Tensor line_start = torch::rand({n, 3}) * 3.0f;
+        torch::Tensor line_end = line_start + (torch::rand({n, 3}) - 0.5f) * 2.0f;
+        torch::Tensor block_cells = torch::rand({n + 100, 3}) * 6.0f - 1.5f;
+        torch::Tensor block_radius = torch::full({n + 100}, 0.2f);
+        raytrace::line_sphere_intersect_mixed_out(line_start, line_end, block_cells, block_radius, ws, mask);
+        REQUIRE(torch::equal(mask, raytrace::line_sphere_intersect(line_start, line_end, block_cells, block_radius)));
+    }
+}
+
+TEST_CASE("mixed precision occlusion benchmark", "[.][benchmark][line_sphere_intersect_mixed]") {
+    // one occlusion batch of a round: 4000 rays against 2000 nearby occluders
+    torch::manual_seed(5);
+    torch::Tensor line_start = torch::rand({4000, 3}) * 3.0f;
+    torch::Tensor line_end = line_start + (torch::rand({4000, 3}) - 0.5f) * 2.0f;
+    torch::Tensor block_cells = torch::rand({2000, 3}) * 6.0f - 1.5f;
+    torch::Tensor block_radius = torch::full({2000}, 0.1f);
+    raytrace_workspace ws;
+    torch::Tensor mask;
+
+    BENCHMARK("float32 line_sphere_intersect_out") {
+        raytrace::line_sphere_intersect_out(line_start, line_end, block_cells, block_radius, ws, mask);
+        return mask.size(0);
+    };
+    BENCHMARK("mixed line_sphere_intersect_mixed_out") {
+        raytrace::line_sphere_intersect_mixed_out(line_start, line_end, block_cells, block_radius, ws, mask);
+        return mask.size(0);
+    };
+}
+
+TEST_CASE("spilled edges merge to the in-memory result", "[edge_store]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+    model_info.ray_coverage_schedule = true;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 4.0f);
+    torch::Tensor prev_row = torch::tensor({0, 199}, torch::dtype(torch::kLong));
+    torch::Tensor prev_col = torch::tensor({199, 0}, torch::dtype(torch::kLong));
+
+    auto [row, col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos, prev_row, prev_col);
+    model_info.ray_spill_bytes = 256; // a run every few tiles
+    model_info.ray_spill_mmap = true;
+    auto [spill_row, spill_col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos, prev_row, prev_col);
+    REQUIRE(row.size(0) > 16);
+    REQUIRE(torch::equal(row, spill_row));
+    REQUIRE(torch::equal(col, spill_col));
+}
+
+TEST_CASE("spilling under the random schedule covers every tile", "[edge_store]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 4.0f);
+    torch::Tensor empty = torch::empty({0}, torch::dtype(torch::kLong));
+    auto [ref_row, ref_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, empty, empty, torch::arange(200));
+
+    // far fewer bytes than the edge list: a stall test on the in-memory edges would never stop
+    model_info.ray_max_rounds = 1000000;
+    model_info.ray_spill_bytes = 256;
+    auto [row, col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos, ref_row, ref_col);
+    REQUIRE(torch::equal(row, ref_row));
+    REQUIRE(torch::equal(col, ref_col));
+}
+
+TEST_CASE("edge_store removes duplicates across runs", "[edge_store]") {
+    edge_store store(10);
+    store.spill(torch::tensor({0, 1, 3}, torch::dtype(torch::kLong)), torch::tensor({5, 2, 9}, torch::dtype(torch::kLong)));
+    store.spill(torch::tensor({1, 2}, torch::dtype(torch::kLong)), torch::tensor({2, 0}, torch::dtype(torch::kLong)));
+    store.spill(torch::tensor({0}, torch::dtype(torch::kLong)), torch::tensor({1}, torch::dtype(torch::kLong)));
+    REQUIRE(store.num_runs() == 3);
+    REQUIRE(store.spilled_edges() == 6);
+
+    auto [row, col] = store.merge();
+    REQUIRE(torch::equal(row, torch::tensor({0, 0, 1, 2, 3}, torch::dtype(torch::kLong))));
+    REQUIRE(torch::equal(col, torch::tensor({1, 5, 2, 0, 9}, torch::dtype(torch::kLong))));
+}
+
+TEST_CASE("fused construction matches one call per class", "[raytrace_fused]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+    model_info.ray_coverage_schedule = true;
+
+    torch::Tensor input_pos = c.ball_random(30, 4.0f);
+    torch::Tensor hidden_pos = c.ball_random(150, 4.0f);
+    torch::Tensor output_pos = c.ball_random(20, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 4.0f);
+
+    // input -> hidden, hidden -> hidden, hidden -> output
+    std::vector<connection_class> classes = {{0, 1}, {1, 1}, {1, 2}};
+    auto fused = tracer.raytrace_fused(model_info, glia_pos, {input_pos, hidden_pos, output_pos}, classes);
+    REQUIRE(fused.size() == 3);
+
+    std::vector<std::pair<torch::Tensor, torch::Tensor>> calls = {{input_pos, hidden_pos}, {hidden_pos, hidden_pos}, {hidden_pos, output_pos}};
+    for (size_t k = 0; k < calls.size(); ++k) {
+        auto [ref_row, ref_col] = tracer.raytrace_distance_limited(model_info, glia_pos, calls[k].first, calls[k].second);
+        auto [row, col] = fused[k];
+        REQUIRE(torch::equal(row, ref_row));
+        REQUIRE(torch::equal(col, ref_col));
+    }
+}
+
+TEST_CASE("pair memo reports pairs traced before", "[pair_memo]") {
+    for (int64_t dense_limit : {int64_t(1) << 20, int64_t(0)}) {
+        pair_memo memo(4, 5, torch::kCPU, dense_limit);
+        REQUIRE(memo.dense() == (dense_limit > 0));
+        torch::Tensor seen = memo.test_and_set(torch::tensor({0, 1, 3}), torch::tensor({4, 2, 0}));
+        REQUIRE(!seen.any().item<bool>());
+        seen = memo.test_and_set(torch::tensor({1, 3, 2, 0}), torch::tensor({2, 1, 2, 4}));
+        REQUIRE(torch::equal(seen, torch::tensor({true, false, false, true})));
+        REQUIRE(memo.stats().queried == 7);
+        REQUIRE(memo.stats().hits == 2);
+    }
+}
+
+TEST_CASE("pair memo bitset matches the sorted keys across words", "[pair_memo]") {
+    // 30 * 40 pairs span many bit words; every batch holds distinct pairs, several of them in the same word
+    torch::manual_seed(9);
+    pair_memo dense(30, 40, torch::kCPU);
+    pair_memo sparse(30, 40, torch::kCPU, 0);
+    REQUIRE(dense.dense());
+    for (int round = 0; round < 20; ++round) {
+        torch::Tensor key = torch::randperm(30 * 40, torch::dtype(torch::kLong)).slice(0, 0, 150);
+        torch::Tensor row = torch::div(key, 40, "floor");
+        torch::Tensor col = key % 40;
+        REQUIRE(torch::equal(dense.test_and_set(row, col), sparse.test_and_set(row, col)));
+    }
+    REQUIRE(dense.stats().hits > 0);
+    REQUIRE(dense.stats().hits == sparse.stats().hits);
+}
+
+TEST_CASE("pair memo keeps the random schedule exact", "[raytrace_distance_limited]") {
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.1f;
+    model_info.con_rad = 1.5f;
+    model_info.ray_max_rounds = 200;
+    model_info.ray_pair_memo = true;
+
+    torch::Tensor hidden_pos = c.ball_random(200, 4.0f);
+    torch::Tensor glia_pos = c.ball_random(50, 4.0f);
+    torch::Tensor empty = torch::empty({0}, torch::dtype(torch::kLong));
+
+    auto [row, col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos);
+    REQUIRE(tracer.memo_stats.queried > 0);
+    REQUIRE(tracer.memo_stats.hits > 0); // batch centres overlap
+
+    // every edge found is a valid edge of the exhaustive reference
+    auto [ref_row, ref_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, empty, empty, torch::arange(200));
+    torch::Tensor ref_hash = ref_row * 200 + ref_col;
+    torch::Tensor hash = row * 200 + col;
+    REQUIRE(torch::isin(hash, ref_hash).all().item<bool>());
+}
+
+TEST_CASE("occluder culling keeps wide domains exact", "[raytrace_distance_limited]") {
+    // most cells are far from any one bundle, so nearly every occluder is culled per round
+    cells c;
+    raytrace tracer;
+    modeldata model_info{};
+    model_info.ray_neuron_intersect = true;
+    model_info.neuron_rad = 0.2f;
+    model_info.con_rad = 1.5f;
+    model_info.ray_coverage_schedule = true;
+
+    torch::Tensor hidden_pos = c.ball_random(400, 10.0f);
+    torch::Tensor glia_pos = c.ball_random(600, 10.0f);
+    torch::Tensor empty = torch::empty({0}, torch::dtype(torch::kLong));
+
+    auto [row, col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos);
+    auto [ref_row, ref_col] =
+        tracer.raytrace_incremental(model_info, glia_pos, hidden_pos, hidden_pos, empty, empty, torch::arange(400));
+    REQUIRE(row.size(0) > 0);
+    REQUIRE(torch::equal(row, ref_row));
+    REQUIRE(torch::equal(col, ref_col));
+
+    // the random schedule goes through the same culling
+    model_info.ray_coverage_schedule = false;
+    model_info.ray_max_rounds = 100;
+    auto [rnd_row, rnd_col] = tracer.raytrace_distance_limited(model_info, glia_pos, hidden_pos, hidden_pos);
+    torch::Tensor ref_hash = ref_row * 400 + ref_col;
+    REQUIRE(torch::isin(rnd_row * 400 + rnd_col, ref_hash).all().item<bool>());
+}
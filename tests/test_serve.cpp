@@ -0,0 +1,102 @@
+#include "network/network.hpp"
+#include "serve/serve.hpp"
+#include <atomic>
+#include <catch2/catch_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+
+TEST_CASE("micro_batcher coalesces concurrent requests", "[micro_batcher]") {
+    std::atomic<int64_t> largest_batch{0};
+    micro_batcher batcher(
+        [&](const torch::Tensor &X) {
+            largest_batch = std::max<int64_t>(largest_batch.load(), X.size(0));
+            return X * 2;
+        },
+        8,
+        std::chrono::milliseconds(50));
+
+    std::vector<std::future<torch::Tensor>> results;
+    for (int64_t i = 0; i < 20; ++i)
+        results.push_back(batcher.submit(torch::full({3}, static_cast<float>(i))));
+    for (int64_t i = 0; i < 20; ++i)
+        REQUIRE(results[i].get().equal(torch::full({3}, 2.0f * i)));
+
+    latency_report report = batcher.stats();
+    REQUIRE(report.requests == 20);
+    REQUIRE(report.batches >= 3);
+    REQUIRE(report.batches < 20);
+    REQUIRE(largest_batch.load() == 8);
+    REQUIRE(report.p50_ms <= report.p99_ms);
+}
+
+TEST_CASE("micro_batcher forwards evaluator errors", "[micro_batcher]") {
+    micro_batcher batcher([](const torch::Tensor &) -> torch::Tensor { throw std::runtime_error("bad batch"); }, 4,
+                          std::chrono::microseconds(100));
+    auto result = batcher.submit(torch::zeros({2}));
+    REQUIRE_THROWS_AS(result.get(), std::runtime_error);
+}
+
+TEST_CASE("network save and load round trip", "[network]") {
+    modeldata model_info{};
+    model_info.neuron_size = 6;
+    model_info.input_size = 2;
+    model_info.output_size = 2;
+    model_info.proc_num = 3;
+    model_info.batch_size = 4;
+    model_info.ray_low_precision = true;
+
+    // inputs 0,1 -> hidden 2,3 -> outputs 4,5, plus a recurrent edge
+    torch::Tensor WRowIdx = torch::tensor({2, 3, 2, 4, 5, 3}, torch::dtype(torch::kLong));
+    torch::Tensor WColIdx = torch::tensor({0, 1, 1, 2, 3, 3}, torch::dtype(torch::kLong));
+    network net(model_info, WRowIdx, WColIdx, 3);
+
+    std::string path = (std::filesystem::temp_directory_path() / "raybnn_test_network.pt").string();
+    net.save(path);
+    network loaded = network::load(path);
+    std::filesystem::remove(path);
+
+    REQUIRE(loaded.model_info.neuron_size == 6);
+    REQUIRE(loaded.model_info.proc_num == 3);
+    REQUIRE(loaded.model_info.ray_low_precision);
+    REQUIRE(loaded.WValues.equal(net.WValues));
+
+    torch::Tensor X = torch::rand({5, 2});
+    torch::Tensor Y = loaded.forward(X);
+    REQUIRE(Y.sizes() == torch::IntArrayRef({5, 2}));
+    REQUIRE(torch::allclose(Y, net.forward(X)));
+}
+
+TEST_CASE("network forward renumbers only the hidden neurons", "[network]") {
+    // inputs 0,1 feed a chain of hidden neurons numbered in shuffled placement order, outputs 34,35 read its end
+    constexpr int64_t I = 2, H = 32, O = 2;
+    constexpr int64_t N = I + H + O;
+    modeldata model_info{};
+    model_info.neuron_size = N;
+    model_info.input_size = I;
+    model_info.output_size = O;
+    model_info.proc_num = 5;
+
+    torch::manual_seed(9);
+    torch::Tensor hidden = torch::randperm(H, torch::dtype(torch::kLong)) + I;
+    torch::Tensor WRowIdx = torch::cat({hidden.slice(0, 1, H), hidden.slice(0, 0, 2), torch::tensor({N - 2, N - 1}), hidden.slice(0, 5, 6)});
+    torch::Tensor WColIdx = torch::cat({hidden.slice(0, 0, H - 1), torch::tensor({0, 1}, torch::dtype(torch::kLong)), hidden.slice(0, H - 2, H), hidden.slice(0, 5, 6)});
+    network net(model_info, WRowIdx, WColIdx, 7);
+    net.bias = torch::randn({N});
+    net.prepare();
+
+    REQUIRE(net.perm.slice(0, 0, I).equal(torch::arange(I)));
+    REQUIRE(net.perm.slice(0, N - O, N).equal(torch::arange(N - O, N)));
+    REQUIRE(net.blocks().defined());
+
+    // the same recurrence on a dense matrix in the stored numbering
+    torch::Tensor W = torch::zeros({N, N});
+    W.index_put_({net.WRowIdx, net.WColIdx}, net.WValues, true);
+    torch::Tensor X = torch::rand({3, I});
+    torch::Tensor state = torch::zeros({N, 3});
+    for (int64_t step = 0; step < model_info.proc_num; ++step) {
+        state.slice(0, 0, I).copy_(X.t());
+        state = torch::tanh(torch::mm(W, state) + net.bias.unsqueeze(1));
+    }
+    torch::Tensor expected = state.slice(0, N - O, N).t();
+    REQUIRE(torch::allclose(net.forward(X), expected, 1e-5, 1e-5));
+}
@@ -0,0 +1,119 @@
+#include "sparse/block_sparse.hpp"
+#include "sparse/sparse.hpp"
+#include <catch2/catch_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("reverse_cuthill_mckee reduces bandwidth and keeps edges", "[reverse_cuthill_mckee]") {
+    // a ring of 64 neurons stored in a shuffled order
+    constexpr int64_t N = 64;
+    torch::manual_seed(7);
+    torch::Tensor shuffle = torch::randperm(N, torch::dtype(torch::kLong));
+    torch::Tensor ring = torch::arange(N, torch::dtype(torch::kLong));
+    torch::Tensor WRowIdx = shuffle.index_select(0, (ring + 1) % N);
+    torch::Tensor WColIdx = shuffle.index_select(0, ring);
+    torch::Tensor WValues = torch::rand({N});
+    torch::Tensor cell_pos = torch::rand({N, 3});
+
+    torch::Tensor old_hash = WRowIdx * N + WColIdx;
+    torch::Tensor old_values = WValues.clone();
+    torch::Tensor old_pos = cell_pos.clone();
+    torch::Tensor old_row = WRowIdx.clone();
+    torch::Tensor old_col = WColIdx.clone();
+
+    torch::Tensor perm = sparse::reverse_cuthill_mckee(WRowIdx, WColIdx, N);
+    REQUIRE(perm.size(0) == N);
+    REQUIRE(std::get<0>(perm.sort()).equal(ring));
+
+    sparse::apply_permutation(perm, cell_pos, WRowIdx, WColIdx, WValues);
+    // a ring has bandwidth 2 under RCM
+    REQUIRE(sparse::bandwidth(WRowIdx, WColIdx) <= 2);
+    REQUIRE(sparse::bandwidth(old_row, old_col) > 2);
+
+    // edges sorted by (row, col)
+    torch::Tensor hash = WRowIdx * N + WColIdx;
+    REQUIRE(hash.equal(std::get<0>(hash.sort())));
+
+    // mapping back through perm restores the original edges, weights and positions
+    REQUIRE(cell_pos.equal(old_pos.index_select(0, perm)));
+    torch::Tensor back_hash = perm.index_select(0, WRowIdx) * N + perm.index_select(0, WColIdx);
+    auto [sorted_old, old_order] = old_hash.sort();
+    auto [sorted_back, back_order] = back_hash.sort();
+    REQUIRE(sorted_old.equal(sorted_back));
+    REQUIRE(old_values.index_select(0, old_order).equal(WValues.index_select(0, back_order)));
+
+    torch::Tensor inv = sparse::inverse_permutation(perm);
+    REQUIRE(inv.index_select(0, perm).equal(ring));
+}
+
+TEST_CASE("reverse_cuthill_mckee keeps the input and output neurons in place", "[reverse_cuthill_mckee]") {
+    // 4 inputs, a shuffled ring of 32 hidden neurons, 3 outputs and one isolated hidden neuron
+    constexpr int64_t I = 4, H = 32, O = 3;
+    constexpr int64_t N = I + H + 1 + O;
+    torch::manual_seed(5);
+    torch::Tensor hidden = torch::randperm(H, torch::dtype(torch::kLong)) + I;
+    torch::Tensor ring = torch::arange(H, torch::dtype(torch::kLong));
+    torch::Tensor WRowIdx = torch::cat({hidden.index_select(0, (ring + 1) % H), hidden.slice(0, 0, I), torch::arange(N - O, N)});
+    torch::Tensor WColIdx = torch::cat({hidden.index_select(0, ring), torch::arange(0, I), hidden.slice(0, 0, O)});
+    torch::Tensor isolated = torch::tensor({I + H}, torch::dtype(torch::kLong));
+
+    torch::Tensor perm = sparse::reverse_cuthill_mckee(WRowIdx, WColIdx, N, I, O);
+    REQUIRE(std::get<0>(perm.sort()).equal(torch::arange(N)));
+    REQUIRE(perm.slice(0, 0, I).equal(torch::arange(I)));
+    REQUIRE(perm.slice(0, N - O, N).equal(torch::arange(N - O, N)));
+    // the isolated neuron comes last among the reordered ones
+    REQUIRE(perm.slice(0, N - O - 1, N - O).equal(isolated));
+
+    torch::Tensor cell_pos = torch::rand({N, 3});
+    torch::Tensor WValues;
+    sparse::apply_permutation(perm, cell_pos, WRowIdx, WColIdx, WValues);
+    // ring edges plus up to 2 for the hidden neurons attached to inputs and outputs
+    torch::Tensor hidden_edges = (WRowIdx >= I) & (WRowIdx < N - O) & (WColIdx >= I) & (WColIdx < N - O);
+    REQUIRE(sparse::bandwidth(WRowIdx.masked_select(hidden_edges), WColIdx.masked_select(hidden_edges)) <= 2);
+}
+
+TEST_CASE("block_sparse matmul matches dense", "[block_sparse]") {
+    // local connectivity around the diagonal plus a few scattered edges, N not a multiple of the block size
+    constexpr int64_t N = 203;
+    torch::manual_seed(11);
+    torch::Tensor i = torch::arange(N, torch::dtype(torch::kLong)).repeat_interleave(9);
+    torch::Tensor offset = torch::randint(-6, 7, {N * 9}, torch::dtype(torch::kLong));
+    torch::Tensor j = (i + offset).clamp(0, N - 1);
+    torch::Tensor far_row = torch::randint(0, N, {40}, torch::dtype(torch::kLong));
+    torch::Tensor far_col = torch::randint(0, N, {40}, torch::dtype(torch::kLong));
+    torch::Tensor WRowIdx = torch::cat({i, far_row});
+    torch::Tensor WColIdx = torch::cat({j, far_col});
+    torch::Tensor WValues = torch::randn({WRowIdx.size(0)});
+
+    // duplicate edges add up, as in a coalesced COO tensor
+    torch::Tensor dense = torch::zeros({N, N});
+    dense.index_put_({WRowIdx, WColIdx}, WValues, true);
+
+    for (int64_t block_size : {0, 4, 8, 16}) {
+        block_sparse W = block_sparse::build(WRowIdx, WColIdx, WValues, N, block_size);
+        if (block_size != 0)
+            REQUIRE(W.block_size() == block_size);
+        REQUIRE(W.num_blocks() > 0);
+        REQUIRE(W.num_scattered() > 0);
+        for (int64_t batch : {1, 5, 37}) {
+            torch::Tensor X = torch::randn({N, batch});
+            REQUIRE(torch::allclose(W.matmul(X), torch::mm(dense, X), 1e-4, 1e-4));
+        }
+    }
+}
+
+TEST_CASE("block_sparse matmul benchmark", "[.][benchmark][block_sparse]") {
+    // banded local connectivity as left by reverse_cuthill_mckee, against the same edges as one torch CSR matrix
+    constexpr int64_t N = 20000;
+    torch::manual_seed(11);
+    torch::Tensor i = torch::arange(N, torch::dtype(torch::kLong)).repeat_interleave(9);
+    torch::Tensor j = (i + torch::randint(-6, 7, {N * 9}, torch::dtype(torch::kLong))).clamp(0, N - 1);
+    torch::Tensor WValues = torch::randn({N * 9});
+    block_sparse W = block_sparse::build(i, j, WValues, N);
+    torch::Tensor csr = torch::sparse_coo_tensor(torch::stack({i, j}), WValues, {N, N}).coalesce().to_sparse_csr();
+
+    for (int64_t batch : {1, 16, 64}) {
+        torch::Tensor X = torch::randn({N, batch});
+        BENCHMARK("torch CSR, batch " + std::to_string(batch)) { return torch::mm(csr, X); };
+        BENCHMARK("block_sparse, batch " + std::to_string(batch)) { return W.matmul(X); };
+    }
+}